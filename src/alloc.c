@@ -0,0 +1,55 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "alloc.h"
+
+/*
+ * Built with NFTOP_ALLOC_COUNT (make alloc_check), malloc(), calloc() and realloc() are linked with
+ * --wrap, so that every call made by nftop goes through the counters below; allocations made inside
+ * the C library (getifaddrs(), getnameinfo(), stdio) are not counted. The dump threads allocate too,
+ * hence the atomic increments.
+ */
+
+#ifdef NFTOP_ALLOC_COUNT
+
+static uint64_t allocations = 0;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+/* heap allocations made by nftop so far */
+uint64_t allocCount() {
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+#else
+
+uint64_t allocCount() {
+    return 0;
+}
+
+#endif
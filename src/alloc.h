@@ -0,0 +1,17 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_ALLOC_H
+#define _NFTOP_ALLOC_H
+
+#define NFTOP_ALLOC_WARMUP      3   // refreshes that may allocate while the arenas, indexes and pools grow
+#define NFTOP_ALLOC_REFRESHES   8   // refreshes checked by the allocation-counting build before it exits
+
+uint64_t allocCount();
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmnl/libmnl.h>
+
+#include "nftop.h"
+#include "arena.h"
+
+/*
+ * A generation of connections is a set of columns (struct Connections), appended to by the
+ * collectors and grown by doubling. The previous generation, which rates are computed against,
+ * only keeps the columns the next one reads: swapping hands them over and takes back those of the
+ * generation before, so that once the columns have grown to the size of the table no connection
+ * is allocated or freed on the heap. The presentation data of the connections that are enriched
+ * comes from a pair of arenas, swapped along.
+ */
+static struct Connections connections = { 0 };  // the current generation
+static struct Connections previous = { 0 };     // the kept columns of the previous generation
+static struct Arena info_arenas[2] = {
+    { NULL, NULL, sizeof(struct ConnectionInfo) },
+    { NULL, NULL, sizeof(struct ConnectionInfo) },
+};
+static int arena_current = 0;
+
+/* a zeroed record of arena */
+static void *arena_alloc(struct Arena *arena) {
+    struct ArenaBlock *block = arena->curr;
+    void *record;
+
+    if (block == NULL || block->used == NFTOP_ARENA_BLOCK) {
+        if (block != NULL && block->next != NULL) {
+            block = block->next;
+        } else {
+            if (!(block = malloc(sizeof(struct ArenaBlock) + NFTOP_ARENA_BLOCK * arena->size))) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+            block->next = NULL;
+
+            if (arena->curr != NULL)
+                arena->curr->next = block;
+            else
+                arena->head = block;
+        }
+        block->used = 0;
+        arena->curr = block;
+    }
+
+    record = block->records + block->used++ * arena->size;
+    memset(record, 0, arena->size);
+
+    return record;
+}
+
+static void arena_rewind(struct Arena *arena) {
+    arena->curr = arena->head;
+    if (arena->curr != NULL)
+        arena->curr->used = 0;
+}
+
+static void arena_free(struct Arena *arena) {
+    struct ArenaBlock *block, *next;
+
+    for (block = arena->head; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    arena->head = arena->curr = NULL;
+}
+
+/* grows a column to size entries of width bytes */
+static void *column_grow(void *column, size_t size, size_t width) {
+    if (!(column = realloc(column, size * width))) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+
+    return column;
+}
+
+/* grows the columns of the current generation to hold at least n connections */
+static void arena_reserve(struct Connections *c, size_t n) {
+    size_t size;
+
+    if (n > c->size_kept) {
+        for (size = c->size_kept ? c->size_kept : NFTOP_ARENA_BLOCK; size < n; size *= 2)
+            ;
+        c->id = column_grow(c->id, size, sizeof(*c->id));
+        c->time_start = column_grow(c->time_start, size, sizeof(*c->time_start));
+        c->bytes_orig = column_grow(c->bytes_orig, size, sizeof(*c->bytes_orig));
+        c->bytes_repl = column_grow(c->bytes_repl, size, sizeof(*c->bytes_repl));
+        c->time_seen = column_grow(c->time_seen, size, sizeof(*c->time_seen));
+        c->info = column_grow(c->info, size, sizeof(*c->info));
+        c->size_kept = size;
+    }
+
+    if (n > c->size) {
+        for (size = c->size ? c->size : NFTOP_ARENA_BLOCK; size < n; size *= 2)
+            ;
+        c->proto_l3 = column_grow(c->proto_l3, size, sizeof(*c->proto_l3));
+        c->netns = column_grow(c->netns, size, sizeof(*c->netns));
+        c->delta = column_grow(c->delta, size, sizeof(*c->delta));
+        c->flags = column_grow(c->flags, size, sizeof(*c->flags));
+        c->bps_rx = column_grow(c->bps_rx, size, sizeof(*c->bps_rx));
+        c->bps_tx = column_grow(c->bps_tx, size, sizeof(*c->bps_tx));
+        c->bps_sum = column_grow(c->bps_sum, size, sizeof(*c->bps_sum));
+        c->proto_l4 = column_grow(c->proto_l4, size, sizeof(*c->proto_l4));
+        c->status_l4 = column_grow(c->status_l4, size, sizeof(*c->status_l4));
+        c->status = column_grow(c->status, size, sizeof(*c->status));
+        c->mark = column_grow(c->mark, size, sizeof(*c->mark));
+        c->sport = column_grow(c->sport, size, sizeof(*c->sport));
+        c->dport = column_grow(c->dport, size, sizeof(*c->dport));
+        c->addrs = column_grow(c->addrs, size, sizeof(*c->addrs));
+        if (c->samples != NULL)
+            c->samples = column_grow(c->samples, size, sizeof(*c->samples));
+        c->size = size;
+    }
+}
+
+/* the connections of the current generation; valid until the next arenaSwap() */
+struct Connections *arenaConnections() {
+    return &connections;
+}
+
+/* the kept columns of the previous generation */
+const struct Connections *arenaPrevious() {
+    return &previous;
+}
+
+/* appends a connection, zeroed, to the current generation; returns its index */
+uint32_t arenaAlloc() {
+    struct Connections *c = &connections;
+    uint32_t ct = c->count++;
+
+    arena_reserve(c, c->count);
+
+    c->id[ct] = 0;
+    c->time_start[ct] = 0;
+    c->bytes_orig[ct] = 0;
+    c->bytes_repl[ct] = 0;
+    c->time_seen[ct] = 0;
+    c->info[ct] = NULL;
+    c->proto_l3[ct] = 0;
+    c->netns[ct] = 0;
+    c->delta[ct] = 0;
+    c->flags[ct] = 0;
+    c->bps_rx[ct] = 0;
+    c->bps_tx[ct] = 0;
+    c->bps_sum[ct] = 0;
+    c->proto_l4[ct] = 0;
+    c->status_l4[ct] = 0;
+    c->status[ct] = 0;
+    c->mark[ct] = 0;
+    c->sport[ct] = 0;
+    c->dport[ct] = 0;
+    memset(&c->addrs[ct], 0, sizeof(struct ConnectionAddresses));
+
+    return ct;
+}
+
+/* the sample of connection ct of the current generation, flagged as set; the column is made on first use */
+struct ConnectionSample *arenaSample(uint32_t ct) {
+    struct Connections *c = &connections;
+
+    if (c->samples == NULL)
+        c->samples = column_grow(NULL, c->size, sizeof(*c->samples));
+    c->flags[ct] |= NFTOP_CT_SAMPLE;
+
+    return &c->samples[ct];
+}
+
+/* zeroed presentation data of a connection of the current generation, valid as long as it */
+struct ConnectionInfo *arenaAllocInfo() {
+    return arena_alloc(&info_arenas[arena_current]);
+}
+
+/* gives back ct if it is the last connection allocated */
+void arenaRewind(uint32_t ct) {
+    if (connections.count > 0 && ct == connections.count - 1)
+        connections.count--;
+}
+
+/* starts a new generation: the current one becomes the previous one, and the one before is reused */
+void arenaSwap() {
+    struct Connections kept = previous;
+
+    previous.id = connections.id;
+    previous.time_start = connections.time_start;
+    previous.bytes_orig = connections.bytes_orig;
+    previous.bytes_repl = connections.bytes_repl;
+    previous.time_seen = connections.time_seen;
+    previous.info = connections.info;
+    previous.size_kept = connections.size_kept;
+    previous.count = connections.count;
+
+    connections.id = kept.id;
+    connections.time_start = kept.time_start;
+    connections.bytes_orig = kept.bytes_orig;
+    connections.bytes_repl = kept.bytes_repl;
+    connections.time_seen = kept.time_seen;
+    connections.info = kept.info;
+    connections.size_kept = kept.size_kept;
+    connections.count = 0;
+
+    arena_current ^= 1;
+    arena_rewind(&info_arenas[arena_current]);
+}
+
+static void connections_free(struct Connections *c) {
+    free(c->id);
+    free(c->time_start);
+    free(c->bytes_orig);
+    free(c->bytes_repl);
+    free(c->time_seen);
+    free(c->info);
+    free(c->proto_l3);
+    free(c->netns);
+    free(c->delta);
+    free(c->flags);
+    free(c->bps_rx);
+    free(c->bps_tx);
+    free(c->bps_sum);
+    free(c->proto_l4);
+    free(c->status_l4);
+    free(c->status);
+    free(c->mark);
+    free(c->sport);
+    free(c->dport);
+    free(c->addrs);
+    free(c->samples);
+    memset(c, 0, sizeof(struct Connections));
+}
+
+void arenaFree() {
+    int i;
+
+    connections_free(&connections);
+    connections_free(&previous);
+
+    for (i = 0; i < 2; i++)
+        arena_free(&info_arenas[i]);
+}
@@ -0,0 +1,36 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_ARENA_H
+#define _NFTOP_ARENA_H
+
+#define NFTOP_ARENA_BLOCK   256     // records per arena block, and the smallest size of the connection columns
+
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    char records[];
+};
+
+/* the records of one generation, bump-allocated from a chain of blocks */
+struct Arena {
+    struct ArenaBlock *head;
+    struct ArenaBlock *curr;
+    size_t size;            // bytes of a record
+};
+
+struct Connections *arenaConnections();
+const struct Connections *arenaPrevious();
+uint32_t arenaAlloc();
+struct ConnectionSample *arenaSample(uint32_t);
+struct ConnectionInfo *arenaAllocInfo();
+void arenaRewind(uint32_t);
+void arenaSwap();
+void arenaFree();
+
+#endif
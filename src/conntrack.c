@@ -0,0 +1,1555 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <libmnl/libmnl.h>
+#include <libnetfilter_conntrack/libnetfilter_conntrack.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#ifndef __FILENAME__
+#   define __FILENAME__ "src/conntrack.c"
+#endif
+
+#include "nftop.h"
+#include "conntrack.h"
+#include "arena.h"
+#include "flow.h"
+#include "proc.h"
+#include "netns.h"
+#include "display.h"
+#include "util.h"
+#include "intern.h"
+
+/* an entry of the live flow table maintained in event mode (-e) and by sharded dumps (-H) */
+struct FlowEntry {
+    struct Flow flow;
+    uint64_t seen_orig;     // counters as of the last refresh of this entry (sharded dumps: the one before)
+    uint64_t seen_repl;
+    uint64_t seen_time;     // sharded dumps: when seen_orig/seen_repl were read, 0 if never
+    int dirty;              // NEW/UPDATE event received since the last refresh
+    int active;             // counters moved at the last refresh
+    int refreshed;          // refreshed during the current interval
+    uint32_t generation;    // last resync dump in which the entry was seen
+    struct FlowEntry *next;
+};
+
+/* the entry a per-flow refresh (NFCT_Q_GET) is for; none while a resync dump fills the table */
+struct RefreshTarget {
+    struct FlowEntry *entry;
+    int replaced;           // the tuple was answered by another conntrack, so the entry's is gone
+};
+
+/* a dump collector: an L3 family of a namespace dumped on its own socket (and thread) into its own flow partition */
+struct Collector {
+    uint8_t family;
+    uint16_t netns;
+    struct mnl_socket *nl;      // persistent ctnetlink socket for dumps
+    char *buf;                  // receive buffer, reused by every dump
+    struct nf_conntrack *ct;    // reused parse target for dumped entries
+    unsigned int seq;
+    struct Flow *flows;         // partition filled by the last dump, reused by every dump
+    size_t count;
+    size_t size;
+    uint64_t syscalls;
+    uint64_t bytes;
+    uint64_t time_seen;         // when the last batch of entries was received
+    int error;                  // errno of a failed dump, 0 on success
+    int rcvbuf;                 // socket receive buffer, grown when a dump overruns
+    int retries;                // dumps restarted after ENOBUFS during the last query
+    int partial;                // the last query gave up and kept an incomplete dump
+    int threaded;               // the last dump ran on its own thread
+    pthread_t thread;
+};
+
+static struct Collector *collectors = NULL;      // an IPv4 and an IPv6 collector per namespace
+static size_t collectors_count = 0;
+
+static struct FlowEntry **flow_table = NULL;
+static size_t flow_table_size = 0;
+static size_t flow_table_count = 0;
+static uint32_t flow_generation = 0;
+static uint32_t shard_next = 0;                  // shard refreshed by the next sharded dump
+
+static struct nfct_handle *event_handle = NULL;  // subscribed to NEW/UPDATE/DESTROY
+static struct nfct_handle *query_handle = NULL;  // resync dumps and per-flow counter refresh
+static struct nf_conntrack *query_ct = NULL;
+static struct RefreshTarget query_target = { 0 };  // the entry query_handle is refreshing, the data of refresh_cb()
+static int event_resync = 1;                     // a full dump is required (startup, lost events)
+static int event_iter = 0;
+
+static struct mnl_socket **stats_nl = NULL;      // a socket per namespace for the stats queries
+static unsigned int stats_seq = 0;
+
+static struct ProcReader proc_reader = { 0 };    // read buffer of the /proc/net/nf_conntrack collector (-f)
+
+static struct nfct_handle *watch_handle = NULL;  // single-flow queries of watch mode (-W)
+static struct nf_conntrack *watch_ct = NULL;
+static struct Flow watch_flow;                   // tuple of the watched flow, and its counters as of the last poll
+
+static struct nfct_handle *closed_handle = NULL; // DESTROY listener of the dump mode (-C)
+static struct Flow closed_ring[NFTOP_CLOSED_RING];  // recently closed flows, with their final counters
+static uint64_t closed_head = 0;                 // flows pushed into the ring
+static uint64_t closed_tail = 0;                 // flows already merged into a query
+
+/* expand a flow record into connection ct of conns, zeroed; returns -1 if the flow is not displayed by nftop */
+int flow2connection(const struct Flow *flow, struct Connections *conns, uint32_t ct) {
+    time_t stop, delta_time;
+
+    if (flow->proto_l3 != AF_INET && flow->proto_l3 != AF_INET6)
+        return -1;
+
+    switch(flow->proto_l4) {
+        case IPPROTO_TCP:
+            conns->status_l4[ct] = flow->status_l4;
+            break;
+        case IPPROTO_UDP:
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+        case IPPROTO_IGMP:
+        case IPPROTO_IPV6:
+        case 89:    // OSPF
+        case 112:   // VRRP
+            break;
+        default:
+            DLOG(NFTOP_FLAGS_DEBUG, "unknown l4proto (%d); discarding.\n", flow->proto_l4);
+            return -1;
+    }
+
+    conns->id[ct] = flow->id;
+
+    stop = flow->time_stop / NSEC_PER_SEC;
+    if (stop == 0) {
+        time(&stop);
+    }
+
+    if (!flow->time_start) {
+        delta_time = (time_t)NFTOP_INTERVAL;
+        NFTOP_FLAGS_TIMESTAMP = 0;
+        NFTOP_U_DISPLAY_AGE = 0;
+    } else {
+        delta_time = stop - (time_t)(flow->time_start / NSEC_PER_SEC);
+    }
+
+    conns->delta[ct] = delta_time;
+    conns->time_start[ct] = flow->time_start;
+    conns->time_seen[ct] = flow->time_seen;
+    conns->netns[ct] = flow->netns;
+
+    conns->bytes_orig[ct] = flow->bytes_orig;
+    conns->bytes_repl[ct] = flow->bytes_repl;
+
+    conns->proto_l3[ct] = flow->proto_l3;
+    conns->proto_l4[ct] = flow->proto_l4;
+
+    conns->mark[ct] = flow->mark;
+
+    memcpy(&conns->addrs[ct].orig_src, &flow->orig_src, sizeof(struct in6_addr));
+    memcpy(&conns->addrs[ct].orig_dst, &flow->orig_dst, sizeof(struct in6_addr));
+    memcpy(&conns->addrs[ct].repl_src, &flow->repl_src, sizeof(struct in6_addr));
+    memcpy(&conns->addrs[ct].repl_dst, &flow->repl_dst, sizeof(struct in6_addr));
+
+    // the local source port is the (post-NAT) reply destination port
+    conns->sport[ct] = ntohs(flow->repl_dport);
+    conns->dport[ct] = ntohs(flow->orig_dport);
+
+    if (flow->proto_l4 == IPPROTO_ICMP || flow->proto_l4 == IPPROTO_ICMPV6) {
+        conns->sport[ct] = 0;
+        conns->dport[ct] = 0;
+    }
+
+    conns->status[ct] = flow->status;
+
+    if ((flow->status & IPS_DST_NAT) == IPS_DST_NAT)
+        conns->flags[ct] |= NFTOP_CT_DST_NAT;
+    if ((flow->status & IPS_SRC_NAT) == IPS_SRC_NAT)
+        conns->flags[ct] |= NFTOP_CT_SRC_NAT;
+
+    return 0;
+}
+
+/*
+ * the presentation data of ct, made on first use. It comes from the arena of ct's generation, so
+ * only the connections that may be displayed carry it.
+ */
+struct ConnectionInfo *connectionInfo(struct Connections *conns, uint32_t ct) {
+    if (conns->info[ct] == NULL)
+        conns->info[ct] = arenaAllocInfo();
+
+    return conns->info[ct];
+}
+
+/* looks up the service names of the ports of ct, for the connections displayed, unless a previous generation did */
+void connectionServices(struct Connections *conns, uint32_t ct) {
+    struct ConnectionInfo *info = connectionInfo(conns, ct);
+    struct servent *service;
+    char proto4[NFTOP_PROTO_LEN], name[NI_MAXSERV];
+
+    if (!NFTOP_U_DNS || NFTOP_U_NUMERIC_PORT || (info->resolved & NFTOP_RESOLVED_SERVICES))
+        return;
+    info->resolved |= NFTOP_RESOLVED_SERVICES;
+
+    getIPProtocolName(conns->proto_l3[ct], conns->proto_l4[ct], proto4, sizeof(proto4));
+    proto4[3] = '\0'; // truncate any protocol version; i.e. "udp6"->"udp"
+    service = getservbyport(htons(conns->sport[ct]), proto4);
+    if (service != NULL) {
+        snprintf(name, NFTOP_MAX_SERVICE, "%s", service->s_name);
+        info->sport_str = internString(name);
+    }
+
+    service = getservbyport(htons(conns->dport[ct]), proto4);
+    if (service != NULL) {
+        snprintf(name, NFTOP_MAX_SERVICE, "%s", service->s_name);
+        info->dport_str = internString(name);
+    }
+}
+
+/* L3 family the dump is restricted to by -4/-6 */
+static uint8_t filter_family() {
+    if (NFTOP_U_IPV4 == NFTOP_U_IPV6)
+        return AF_UNSPEC;
+    return NFTOP_U_IPV4 ? AF_INET : AF_INET6;
+}
+
+/* number of shards the mark mask of -H splits the table into; 1 without sharding */
+static uint32_t shard_count() {
+    if (NFTOP_U_SHARD_MASK == 0)
+        return 1;
+    return (NFTOP_U_SHARD_MASK >> __builtin_ctz(NFTOP_U_SHARD_MASK)) + 1;
+}
+
+static uint32_t shard_of(const struct Flow *flow) {
+    if (NFTOP_U_SHARD_MASK == 0)
+        return 0;
+    return (flow->mark & NFTOP_U_SHARD_MASK) >> __builtin_ctz(NFTOP_U_SHARD_MASK);
+}
+
+/* adds the CLI filters ctnetlink can evaluate itself to a dump request */
+static void put_dump_filter(struct nlmsghdr *nlh, uint8_t family) {
+    struct nfgenmsg *nfh = mnl_nlmsg_get_payload(nlh);
+    uint32_t mark = NFTOP_U_MARK, mask = NFTOP_U_MARK_MASK;
+
+    nfh->nfgen_family = family;
+
+    // a sharded dump only covers the marks of the shard being refreshed (the masks don't overlap)
+    if (NFTOP_U_SHARD_MASK != 0) {
+        mark |= (uint32_t)NFTOP_DUMP_SHARD << __builtin_ctz(NFTOP_U_SHARD_MASK);
+        mask |= NFTOP_U_SHARD_MASK;
+    }
+
+    if (mask != 0) {
+        mnl_attr_put_u32(nlh, CTA_MARK, htonl(mark));
+        mnl_attr_put_u32(nlh, CTA_MARK_MASK, htonl(mask));
+    }
+
+    // the kernel treats the default zone (0) as "no zone filter"; that case is left to flow_filtered()
+    if (NFTOP_U_ZONE > 0)
+        mnl_attr_put_u16(nlh, CTA_ZONE, htons(NFTOP_U_ZONE));
+}
+
+/* the same filters as put_dump_filter(), for dumps issued through libnetfilter_conntrack */
+static struct nfct_filter_dump *create_dump_filter() {
+    struct nfct_filter_dump *filter;
+    struct nfct_filter_dump_mark mark = {
+        .val = NFTOP_U_MARK,
+        .mask = NFTOP_U_MARK_MASK,
+    };
+
+    if (!(filter = nfct_filter_dump_create())) {
+        perror("nfct_filter_dump_create");
+        exit(EXIT_FAILURE);
+    }
+
+    if (filter_family() != AF_UNSPEC)
+        nfct_filter_dump_set_attr_u8(filter, NFCT_FILTER_DUMP_L3NUM, filter_family());
+
+    if (NFTOP_U_MARK_MASK != 0)
+        nfct_filter_dump_set_attr(filter, NFCT_FILTER_DUMP_MARK, &mark);
+
+    return filter;
+}
+
+/* userspace check of the mark/zone filters; for events, and kernels that ignore the dump filter */
+static int flow_filtered(const struct Flow *flow) {
+    if ((flow->mark & NFTOP_U_MARK_MASK) != NFTOP_U_MARK)
+        return 1;
+
+    if (NFTOP_U_ZONE >= 0 && flow->zone != NFTOP_U_ZONE)
+        return 1;
+
+    return 0;
+}
+
+/* append a connection built from flow to conns; returns its index, -1 if the flow is not displayed */
+static ssize_t append_flow(struct Connections *conns, const struct Flow *flow) {
+    uint32_t new_ct;
+
+    if (flow_filtered(flow))
+        return -1;
+
+    // the connection takes the next index of the current generation's columns
+    new_ct = arenaAlloc();
+
+    if (flow2connection(flow, conns, new_ct) == -1) {
+        arenaRewind(new_ct);
+        return -1;
+    }
+
+    return new_ct;
+}
+
+/* resets the reused dump object; objects holding allocated attributes are replaced instead */
+static void reset_dump_ct(struct Collector *c) {
+    if (nfct_attr_is_set(c->ct, ATTR_SECCTX) || nfct_attr_is_set(c->ct, ATTR_HELPER_INFO) ||
+        nfct_attr_is_set(c->ct, ATTR_CONNLABELS) || nfct_attr_is_set(c->ct, ATTR_CONNLABELS_MASK)) {
+        nfct_destroy(c->ct);
+        if (!(c->ct = nfct_new())) {
+            perror("nfct_new");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        memset(c->ct, 0, nfct_maxsize());
+    }
+}
+
+/* parses a dumped entry into the collector's flow partition; runs on the collector's thread */
+static int data_cb(const struct nlmsghdr *nlh, void *data)
+{
+    struct Collector *c = (struct Collector *) data;
+    struct Flow *flow;
+
+    if (c->count == c->size) {
+        c->size = c->size ? c->size * 2 : NFTOP_PARTITION_SIZE;
+        if (!(c->flows = realloc(c->flows, c->size * sizeof(struct Flow)))) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    flow = &c->flows[c->count];
+
+    // libnetfilter_conntrack is the reference parser, and the fallback for messages the fast path rejects
+    if (NFTOP_U_NFCT_PARSE || nlmsg2flow(nlh, flow) == -1) {
+        reset_dump_ct(c);
+        if (nfct_nlmsg_parse(nlh, c->ct) < 0)
+            return MNL_CB_OK;
+        ct2flow(c->ct, flow);
+    }
+    flow->time_seen = c->time_seen;
+    flow->netns = c->netns;
+
+    if (flow->proto_l3 == c->family)
+        c->count++;
+
+    return MNL_CB_OK;
+}
+
+/* sets a socket receive buffer beyond rmem_max when permitted (CAP_NET_ADMIN) */
+static void set_rcvbuf(int fd, int rcvbuf) {
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+}
+
+static int collector_socket(struct Collector *c) {
+    int on = 1;
+
+    // the socket belongs to the namespace it is created in, whichever thread uses it later
+    if (netnsEnter(c->netns) == -1) {
+        fprintf(stderr, "setns(%s): %s\n", netnsName(c->netns), strerror(errno));
+        return -1;
+    }
+    c->nl = mnl_socket_open(NETLINK_NETFILTER);
+    netnsRestore();
+
+    if (c->nl == NULL) {
+        perror("mnl_socket_open");
+        return -1;
+    }
+
+    if (mnl_socket_bind(c->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+        perror("mnl_socket_bind");
+        mnl_socket_close(c->nl);
+        c->nl = NULL;
+        return -1;
+    }
+
+    // the socket only carries unicast dump replies; overruns are still reported by the dump itself
+    mnl_socket_setsockopt(c->nl, NETLINK_NO_ENOBUFS, &on, sizeof(on));
+
+    if (c->rcvbuf > 0)
+        set_rcvbuf(mnl_socket_get_fd(c->nl), c->rcvbuf);
+
+    return 0;
+}
+
+/* closes the socket of a collector */
+static void collector_socket_close(struct Collector *c) {
+    mnl_socket_close(c->nl);
+    c->nl = NULL;
+}
+
+static void collector_close(struct Collector *c) {
+    if (c->nl != NULL)
+        collector_socket_close(c);
+
+    if (c->ct != NULL) {
+        nfct_destroy(c->ct);
+        c->ct = NULL;
+    }
+
+    free(c->buf);
+    c->buf = NULL;
+
+    free(c->flows);
+    c->flows = NULL;
+    c->count = c->size = 0;
+}
+
+static int collector_open(struct Collector *c) {
+    c->rcvbuf = NFTOP_U_RCVBUF;
+
+    if (collector_socket(c) == -1)
+        return -1;
+
+    if (!(c->buf = malloc(NFTOP_DUMP_BUFSIZ))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!(c->ct = nfct_new())) {
+        perror("nfct_new");
+        exit(EXIT_FAILURE);
+    }
+
+    return 0;
+}
+
+/* dumps the collector's family into its partition; errors are left in c->error for the caller */
+static void *collector_dump(void *data) {
+    struct Collector *c = (struct Collector *) data;
+    char req[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfh;
+    ssize_t len;
+    int ret;
+
+    c->count = 0;
+    c->syscalls = 0;
+    c->bytes = 0;
+    c->error = 0;
+
+    nlh = mnl_nlmsg_put_header(req);
+    // GET_CTRZERO dumps like GET and then zeroes the counters, so each dump carries one interval's bytes
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | (NFTOP_U_ZERO ? IPCTNL_MSG_CT_GET_CTRZERO : IPCTNL_MSG_CT_GET);
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    nlh->nlmsg_seq = ++c->seq;
+
+    nfh = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+    nfh->version = NFNETLINK_V0;
+    nfh->res_id = 0;
+
+    put_dump_filter(nlh, c->family);
+
+    c->syscalls++;
+    ret = mnl_socket_sendto(c->nl, nlh, nlh->nlmsg_len);
+
+    while (ret != -1) {
+        c->syscalls++;
+        len = mnl_socket_recvfrom(c->nl, c->buf, NFTOP_DUMP_BUFSIZ);
+        if (len == -1) {
+            ret = -1;
+            break;
+        }
+        c->bytes += len;
+        c->time_seen = monotonic_ns();
+
+        ret = mnl_cb_run(c->buf, len, c->seq, mnl_socket_get_portid(c->nl), data_cb, c);
+        if (ret <= MNL_CB_STOP)
+            break;
+    }
+
+    if (ret == -1)
+        c->error = errno;
+
+    return NULL;
+}
+
+/*
+ * runs the collector's dump, restarting it on a fresh socket with twice the receive buffer
+ * when the kernel reports an overrun (ENOBUFS); a dump still overrunning after
+ * NFTOP_DUMP_MAX_RETRIES restarts is kept as a partial result instead of failing. With -Z
+ * the overrun dump has already zeroed the counters it went through, so it isn't restarted.
+ */
+static void *collector_run(void *data) {
+    struct Collector *c = (struct Collector *) data;
+    socklen_t len = sizeof(c->rcvbuf);
+
+    c->retries = 0;
+    c->partial = 0;
+
+    for (;;) {
+        collector_dump(c);
+        if (c->error != ENOBUFS)
+            break;
+
+        // the size the kernel reports is twice the one set; the one set is doubled, for the next dumps too
+        if (c->rcvbuf <= 0) {
+            if (getsockopt(mnl_socket_get_fd(c->nl), SOL_SOCKET, SO_RCVBUF, &c->rcvbuf, &len) == -1)
+                c->rcvbuf = NFTOP_DUMP_BUFSIZ * 2;
+            c->rcvbuf /= 2;
+        }
+        if (c->rcvbuf < NFTOP_DUMP_RCVBUF_MAX)
+            c->rcvbuf *= 2;
+
+        // the overrun dump can't be resumed, and the kernel is still in it; start over on a new socket
+        collector_socket_close(c);
+        if (collector_socket(c) == -1) {
+            c->error = errno;
+            break;
+        }
+
+        if (c->retries == NFTOP_DUMP_MAX_RETRIES || NFTOP_U_ZERO) {
+            c->error = 0;
+            c->partial = 1;
+            break;
+        }
+        c->retries++;
+    }
+
+    return NULL;
+}
+
+static int stats_global_cb(const struct nlmsghdr *nlh, void *data) {
+    struct ConntrackStats *stats = (struct ConntrackStats *) data;
+    const struct nlattr *attr;
+
+    mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+        if (mnl_attr_get_payload_len(attr) < sizeof(uint32_t))
+            continue;
+
+        switch (mnl_attr_get_type(attr)) {
+            case CTA_STATS_GLOBAL_ENTRIES:
+                stats->entries += ntohl(mnl_attr_get_u32(attr));
+                break;
+            case CTA_STATS_GLOBAL_MAX_ENTRIES:
+                // nf_conntrack_max is one limit, reported by every namespace
+                if (ntohl(mnl_attr_get_u32(attr)) > stats->max_entries)
+                    stats->max_entries = ntohl(mnl_attr_get_u32(attr));
+                break;
+        }
+    }
+
+    return MNL_CB_OK;
+}
+
+/* called once per CPU */
+static int stats_cpu_cb(const struct nlmsghdr *nlh, void *data) {
+    struct ConntrackStats *stats = (struct ConntrackStats *) data;
+    const struct nlattr *attr;
+
+    mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+        if (mnl_attr_get_payload_len(attr) < sizeof(uint32_t))
+            continue;
+
+        switch (mnl_attr_get_type(attr)) {
+            case CTA_STATS_INSERT_FAILED:
+                stats->insert_failed += ntohl(mnl_attr_get_u32(attr));
+                break;
+            case CTA_STATS_DROP:
+                stats->drop += ntohl(mnl_attr_get_u32(attr));
+                break;
+            case CTA_STATS_EARLY_DROP:
+                stats->early_drop += ntohl(mnl_attr_get_u32(attr));
+                break;
+        }
+    }
+
+    return MNL_CB_OK;
+}
+
+/* sends a ctnetlink stats request and runs cb on the replies; returns -1 on error */
+static int stats_request(struct mnl_socket *nl, uint8_t type, uint16_t flags, mnl_cb_t cb, struct ConntrackStats *stats) {
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfh;
+    ssize_t len;
+    int ret;
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nlh->nlmsg_seq = ++stats_seq;
+
+    nfh = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+    nfh->nfgen_family = AF_UNSPEC;
+    nfh->version = NFNETLINK_V0;
+    nfh->res_id = 0;
+
+    if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) == -1)
+        return -1;
+
+    do {
+        if ((len = mnl_socket_recvfrom(nl, buf, sizeof(buf))) == -1)
+            return -1;
+        ret = mnl_cb_run(buf, len, stats_seq, mnl_socket_get_portid(nl), cb, stats);
+    } while (ret > MNL_CB_STOP && (flags & NLM_F_DUMP));
+
+    return ret == -1 ? -1 : 0;
+}
+
+/*
+ * refreshes NFTOP_CT_STATS: the table size comes from a single GET_STATS message instead of
+ * counting dumped entries, and the per-CPU counters show pressure on the table
+ */
+void queryStats() {
+    struct ConntrackStats stats;
+    int ns;
+
+    memset(&stats, 0, sizeof(stats));
+
+    if (stats_nl == NULL) {
+        if (!(stats_nl = calloc(netnsCount(), sizeof(struct mnl_socket *)))) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+
+        for (ns = 0; ns < netnsCount(); ns++) {
+            if (netnsEnter(ns) == 0)
+                stats_nl[ns] = mnl_socket_open(NETLINK_NETFILTER);
+            netnsRestore();
+
+            if (stats_nl[ns] != NULL && mnl_socket_bind(stats_nl[ns], 0, MNL_SOCKET_AUTOPID) < 0) {
+                mnl_socket_close(stats_nl[ns]);
+                stats_nl[ns] = NULL;
+            }
+        }
+    }
+
+    for (ns = 0; ns < netnsCount(); ns++) {
+        if (stats_nl[ns] == NULL ||
+            stats_request(stats_nl[ns], IPCTNL_MSG_CT_GET_STATS, 0, stats_global_cb, &stats) == -1 ||
+            stats_request(stats_nl[ns], IPCTNL_MSG_CT_GET_STATS_CPU, NLM_F_DUMP, stats_cpu_cb, &stats) == -1) {
+            DLOG(NFTOP_FLAGS_DEBUG, "conntrack stats unavailable: %s\n", strerror(errno));
+            NFTOP_CT_STATS.valid = false;
+            return;
+        }
+    }
+
+    // the counters are totals since boot; the header shows their increase over the interval. The
+    // kernel's counters are 32-bit and wrap, so the increase is taken modulo 2^32 as well
+    if (NFTOP_CT_STATS.valid) {
+        stats.insert_failed_delta = (uint32_t)(stats.insert_failed - NFTOP_CT_STATS.insert_failed);
+        stats.drop_delta = (uint32_t)(stats.drop - NFTOP_CT_STATS.drop);
+        stats.early_drop_delta = (uint32_t)(stats.early_drop - NFTOP_CT_STATS.early_drop);
+    }
+    stats.valid = true;
+
+    NFTOP_CT_STATS = stats;
+}
+
+void closeStats() {
+    int ns;
+
+    if (stats_nl == NULL)
+        return;
+
+    for (ns = 0; ns < netnsCount(); ns++) {
+        if (stats_nl[ns] != NULL)
+            mnl_socket_close(stats_nl[ns]);
+    }
+
+    free(stats_nl);
+    stats_nl = NULL;
+}
+
+/* receives the pending messages of a non-blocking handle; returns 1 if the socket overran and messages were lost */
+static int catch_pending(struct nfct_handle *h) {
+    int overrun = 0;
+
+    for (;;) {
+        if (nfct_catch(h) != -1)
+            break;
+
+        if (errno == ENOBUFS) {
+            overrun = 1;
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            DLOG(NFTOP_FLAGS_DEBUG, "nfct_catch: %s\n", strerror(errno));
+        break;
+    }
+
+    return overrun;
+}
+
+/* adds an entry of the /proc/net/nf_conntrack collector to the connections (data) */
+static void proc_flow(struct Flow *flow, void *data) {
+    struct Connections *conns = (struct Connections *) data;
+    uint8_t family = filter_family();
+
+    if (family == AF_UNSPEC || flow->proto_l3 == family) {
+        append_flow(conns, flow);
+        NFTOP_CT_COUNT++;
+    }
+}
+
+/*
+ * collector for systems without (or with restricted) ctnetlink: streams the conntrack table from a file
+ * in the format of /proc/net/nf_conntrack (path) through a fixed buffer, line by line into conns
+ */
+int queryProc(struct Connections *conns, const char *path) {
+    int fd;
+
+    if (proc_reader.buf == NULL) {
+        if (!(proc_reader.buf = malloc(NFTOP_PROC_BUFSIZ))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        proc_reader.size = NFTOP_PROC_BUFSIZ;
+        proc_reader.flow_cb = proc_flow;
+    }
+    proc_reader.data = conns;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || procRead(&proc_reader, fd) == -1) {
+        displayClose();
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    NFTOP_DUMP_SYSCALLS = proc_reader.syscalls;
+    NFTOP_DUMP_BYTES = proc_reader.bytes;
+
+    return 0;
+}
+
+static struct FlowEntry **flow_slot(uint32_t id) {
+    struct FlowEntry **slot = &flow_table[id & (flow_table_size - 1)];
+
+    while (*slot != NULL && (*slot)->flow.id != id)
+        slot = &(*slot)->next;
+
+    return slot;
+}
+
+static void flow_table_grow() {
+    struct FlowEntry **old_table = flow_table;
+    struct FlowEntry *entry, *next;
+    size_t old_size = flow_table_size, i;
+
+    flow_table_size = old_size ? old_size * 2 : NFTOP_FLOW_BUCKETS;
+    if (!(flow_table = calloc(flow_table_size, sizeof(struct FlowEntry *)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_size; i++) {
+        for (entry = old_table[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            entry->next = flow_table[entry->flow.id & (flow_table_size - 1)];
+            flow_table[entry->flow.id & (flow_table_size - 1)] = entry;
+        }
+    }
+
+    free(old_table);
+}
+
+/* overwrites the flow of entry; counters and timestamps missing from an event are kept */
+static void flow_update(struct FlowEntry *entry, const struct Flow *flow, int has_counters) {
+    struct Flow prev;
+
+    memcpy(&prev, &entry->flow, sizeof(struct Flow));
+    memcpy(&entry->flow, flow, sizeof(struct Flow));
+
+    if (!has_counters) {
+        entry->flow.bytes_orig = prev.bytes_orig;
+        entry->flow.bytes_repl = prev.bytes_repl;
+        entry->flow.time_seen = prev.time_seen;
+    }
+    if (!entry->flow.time_start)
+        entry->flow.time_start = prev.time_start;
+}
+
+/* insert or update the entry for flow */
+static struct FlowEntry *flow_upsert(const struct Flow *flow, int has_counters) {
+    struct FlowEntry **slot, *entry;
+
+    if (flow_table_count >= flow_table_size * 2)
+        flow_table_grow();
+
+    slot = flow_slot(flow->id);
+
+    if (*slot == NULL) {
+        if (!(entry = malloc(sizeof(struct FlowEntry)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(entry, 0, sizeof(struct FlowEntry));
+        memcpy(&entry->flow, flow, sizeof(struct Flow));
+        *slot = entry;
+        flow_table_count++;
+        return entry;
+    }
+
+    entry = *slot;
+    flow_update(entry, flow, has_counters);
+
+    return entry;
+}
+
+static void flow_unlink(struct FlowEntry **slot) {
+    struct FlowEntry *entry = *slot;
+
+    *slot = entry->next;
+    free(entry);
+    flow_table_count--;
+}
+
+static void flow_refreshed(struct FlowEntry *entry) {
+    entry->active = entry->flow.bytes_orig != entry->seen_orig || entry->flow.bytes_repl != entry->seen_repl;
+    entry->seen_orig = entry->flow.bytes_orig;
+    entry->seen_repl = entry->flow.bytes_repl;
+    entry->refreshed = 1;
+    entry->dirty = 0;
+}
+
+static void flow_table_free() {
+    struct FlowEntry *entry, *next;
+    size_t i;
+
+    for (i = 0; i < flow_table_size; i++) {
+        for (entry = flow_table[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry);
+        }
+    }
+
+    free(flow_table);
+    flow_table = NULL;
+    flow_table_size = 0;
+    flow_table_count = 0;
+}
+
+/* stores a dumped flow of the current shard, keeping its previous observation to compute its rate from */
+static void shard_refresh(const struct Flow *flow) {
+    struct FlowEntry *entry = *flow_slot(flow->id);
+
+    if (entry != NULL) {
+        // a reused ID is a new flow
+        if (entry->flow.time_start == flow->time_start && entry->flow.time_seen < flow->time_seen) {
+            entry->seen_orig = entry->flow.bytes_orig;
+            entry->seen_repl = entry->flow.bytes_repl;
+            entry->seen_time = entry->flow.time_seen;
+        } else {
+            entry->seen_time = 0;
+        }
+    }
+
+    entry = flow_upsert(flow, 1);
+    entry->generation = flow_generation;
+}
+
+/*
+ * folds the dump of shard NFTOP_DUMP_SHARD into the flow table; flows of the other shards keep
+ * their last observation until their own turn, when the flows missing from the dump are dropped
+ */
+static void shard_merge(struct Collector **active, size_t n) {
+    struct FlowEntry **slot;
+    const struct Flow *closed;
+    uint64_t k;
+    size_t i, j;
+
+    if (flow_table == NULL)
+        flow_table_grow();
+    flow_generation++;
+
+    // flows closed since the last query are accounted from the ring instead of waiting for their shard's turn
+    for (k = closed_tail; k < closed_head; k++) {
+        closed = &closed_ring[k % NFTOP_CLOSED_RING];
+        slot = flow_slot(closed->id);
+        if (*slot != NULL && (*slot)->flow.time_start == closed->time_start)
+            flow_unlink(slot);
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < active[i]->count; j++) {
+            // kernels without mark filtering dump every shard
+            if (shard_of(&active[i]->flows[j]) == (uint32_t)NFTOP_DUMP_SHARD)
+                shard_refresh(&active[i]->flows[j]);
+        }
+    }
+
+    // an incomplete dump can't tell closed flows from missed ones
+    if (NFTOP_DUMP_PARTIAL)
+        return;
+
+    for (i = 0; i < flow_table_size; i++) {
+        slot = &flow_table[i];
+        while (*slot != NULL) {
+            if (shard_of(&(*slot)->flow) == (uint32_t)NFTOP_DUMP_SHARD && (*slot)->generation != flow_generation) {
+                flow_unlink(slot);
+            } else {
+                slot = &(*slot)->next;
+            }
+        }
+    }
+}
+
+/* appends every flow of the table, with the bytes it moved between its last two observations */
+static void shard_append(struct Connections *conns) {
+    struct FlowEntry *entry;
+    struct ConnectionSample *sample;
+    ssize_t new_ct;
+    size_t i;
+
+    for (i = 0; i < flow_table_size; i++) {
+        for (entry = flow_table[i]; entry != NULL; entry = entry->next) {
+            if ((new_ct = append_flow(conns, &entry->flow)) == -1 || entry->seen_time == 0)
+                continue;
+
+            sample = arenaSample(new_ct);
+            sample->orig = entry->flow.bytes_orig - entry->seen_orig;
+            sample->repl = entry->flow.bytes_repl - entry->seen_repl;
+            sample->ns = entry->flow.time_seen - entry->seen_time;
+        }
+    }
+}
+
+/* records the final counters of a destroyed flow; the oldest unmerged flows are overwritten when the ring is full */
+static void closed_push(const struct Flow *flow) {
+    if (flow_filtered(flow) || (filter_family() != AF_UNSPEC && flow->proto_l3 != filter_family()))
+        return;
+
+    closed_ring[closed_head++ % NFTOP_CLOSED_RING] = *flow;
+
+    if (closed_head - closed_tail > NFTOP_CLOSED_RING) {
+        DLOG(NFTOP_FLAGS_DEBUG, "closed flow ring full; %lu flows not accounted\n", closed_head - closed_tail - NFTOP_CLOSED_RING);
+        closed_tail = closed_head - NFTOP_CLOSED_RING;
+    }
+}
+
+/* appends the flows closed since the last query, flagged so their final bytes are accounted without a history match */
+static void append_closed(struct Connections *conns) {
+    ssize_t new_ct;
+
+    for (; closed_tail < closed_head; closed_tail++) {
+        if ((new_ct = append_flow(conns, &closed_ring[closed_tail % NFTOP_CLOSED_RING])) != -1)
+            conns->flags[new_ct] |= NFTOP_CT_CLOSED;
+    }
+}
+
+static int closed_cb(enum nf_conntrack_msg_type type,
+                     struct nf_conntrack *ct,
+                     void *data)
+{
+    struct Flow flow;
+
+    type = type;
+    data = data; // get compiler to ignore that we don't use these params
+
+    if (ct == NULL)
+        return NFCT_CB_CONTINUE;
+
+    ct2flow(ct, &flow);
+    flow.time_seen = monotonic_ns();
+    closed_push(&flow);
+
+    return NFCT_CB_CONTINUE;
+}
+
+/* subscribes to DESTROY events to capture the final counters of flows that end between two dumps */
+int closedOpen() {
+    int fd;
+
+    closed_handle = nfct_open(CONNTRACK, NF_NETLINK_CONNTRACK_DESTROY);
+    if (!closed_handle) {
+        perror("nfct_open");
+        return -1;
+    }
+
+    fd = nfct_fd(closed_handle);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    set_rcvbuf(fd, NFTOP_U_RCVBUF > 0 ? NFTOP_U_RCVBUF : NFTOP_EVENT_RCVBUF);
+
+    nfct_callback_register(closed_handle, NFCT_T_DESTROY, closed_cb, NULL);
+
+    return 0;
+}
+
+/* processes pending DESTROY events; called frequently between queries so the socket does not overrun */
+void closedDrain() {
+    if (closed_handle == NULL)
+        return;
+
+    if (catch_pending(closed_handle))
+        DLOG(NFTOP_FLAGS_DEBUG, "DESTROY socket overrun; final counters of some closed flows were lost\n");
+}
+
+void closedClose() {
+    if (closed_handle != NULL) {
+        nfct_callback_unregister(closed_handle);
+        nfct_close(closed_handle);
+        closed_handle = NULL;
+    }
+}
+
+/* opens a collector (socket and buffers used for the lifetime of the process) per L3 family and namespace */
+int openNFCT() {
+    size_t i;
+
+    collectors_count = netnsCount() * 2;
+    if (!(collectors = calloc(collectors_count, sizeof(struct Collector)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < collectors_count; i++) {
+        collectors[i].family = (i % 2) ? AF_INET6 : AF_INET;
+        collectors[i].netns = i / 2;
+
+        if (collector_open(&collectors[i]) == -1) {
+            closeNFCT();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void closeNFCT() {
+    size_t i;
+
+    for (i = 0; i < collectors_count; i++)
+        collector_close(&collectors[i]);
+
+    free(collectors);
+    collectors = NULL;
+    collectors_count = 0;
+
+    free(proc_reader.buf);
+    proc_reader.buf = NULL;
+
+    flow_table_free();
+}
+
+/*
+ * dumps each requested L3 family of each namespace on its own socket and thread, then merges the partitions
+ * into conns; with -H only one shard of the table is dumped, and conns is filled from the flow table
+ */
+int queryNFCT(struct Connections *conns) {
+    size_t n = 0, i, j;
+    uint8_t family = filter_family();
+    static uint64_t last_dump = 0;
+    uint64_t now;
+
+    if (collectors == NULL && openNFCT() == -1)
+        return -1;
+
+    struct Collector *active[collectors_count];
+
+    // flows destroyed up to now can't be in the dump below; later DESTROYs are merged by the next query
+    closedDrain();
+
+    for (i = 0; i < collectors_count; i++) {
+        if (family == AF_UNSPEC || family == collectors[i].family)
+            active[n++] = &collectors[i];
+    }
+
+    now = monotonic_ns();
+    NFTOP_DUMP_ELAPSED = last_dump ? now - last_dump : 0;
+    last_dump = now;
+
+    NFTOP_DUMP_SHARDS = shard_count();
+    NFTOP_DUMP_SHARD = shard_next;
+    shard_next = (shard_next + 1) % NFTOP_DUMP_SHARDS;
+
+    // the last collector runs on the calling thread; fall back to dumping inline if a thread can't be started
+    for (i = 0; i + 1 < n; i++) {
+        int err = pthread_create(&active[i]->thread, NULL, collector_run, active[i]);
+
+        active[i]->threaded = (err == 0);
+        if (err != 0) {
+            DLOG(NFTOP_FLAGS_DEBUG, "pthread_create: %s; dumping family %d of namespace %d inline\n", strerror(err), active[i]->family, active[i]->netns);
+            collector_run(active[i]);
+        }
+    }
+    active[n - 1]->threaded = 0;
+    collector_run(active[n - 1]);
+
+    for (i = 0; i < n; i++) {
+        if (active[i]->threaded)
+            pthread_join(active[i]->thread, NULL);
+    }
+
+    NFTOP_DUMP_SYSCALLS = 0;
+    NFTOP_DUMP_BYTES = 0;
+    NFTOP_DUMP_RETRIES = 0;
+    NFTOP_DUMP_PARTIAL = 0;
+
+    for (i = 0; i < n; i++) {
+        if (active[i]->error) {
+            displayClose();
+            fprintf(stderr, "error: (%d)(%s)\n", -1, strerror(active[i]->error));
+            exit(EXIT_FAILURE);
+        }
+
+        NFTOP_DUMP_SYSCALLS += active[i]->syscalls;
+        NFTOP_DUMP_BYTES += active[i]->bytes;
+        NFTOP_DUMP_RETRIES += active[i]->retries;
+        NFTOP_DUMP_PARTIAL |= active[i]->partial;
+        NFTOP_CT_COUNT += active[i]->count;
+
+        DLOG(NFTOP_FLAGS_DEBUG, "dump (namespace %d, family %d, shard %d/%d): %lu entries, %lu syscalls, %lu bytes received, %d retries%s\n",
+            active[i]->netns, active[i]->family, NFTOP_DUMP_SHARD + 1, NFTOP_DUMP_SHARDS, active[i]->count, active[i]->syscalls,
+            active[i]->bytes, active[i]->retries, active[i]->partial ? " (partial)" : "");
+    }
+
+    if (NFTOP_U_SHARD_MASK != 0) {
+        shard_merge(active, n);
+        shard_append(conns);
+        NFTOP_CT_COUNT = flow_table_count;
+    } else {
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < active[i]->count; j++)
+                append_flow(conns, &active[i]->flows[j]);
+        }
+    }
+
+    append_closed(conns);
+
+    return 0;
+}
+
+static int event_cb(enum nf_conntrack_msg_type type,
+                    struct nf_conntrack *ct,
+                    void *data)
+{
+    struct FlowEntry **slot, *entry;
+    struct Flow flow;
+
+    data = data; // get compiler to ignore that we don't use this param
+
+    if (ct == NULL)
+        return NFCT_CB_CONTINUE;
+
+    ct2flow(ct, &flow);
+    flow.time_seen = monotonic_ns();
+
+    // flows outside the kernel dump filter are kept out of the table, as a resync would drop them
+    if (type == NFCT_T_DESTROY || flow_filtered(&flow) ||
+        (filter_family() != AF_UNSPEC && flow.proto_l3 != filter_family())) {
+        slot = flow_slot(flow.id);
+
+        if (type == NFCT_T_DESTROY && NFTOP_U_CLOSED) {
+            // the start time identifies the flow in the previous interval's list
+            if (!flow.time_start && *slot != NULL)
+                flow.time_start = (*slot)->flow.time_start;
+            closed_push(&flow);
+        }
+
+        if (*slot != NULL)
+            flow_unlink(slot);
+    } else {
+        entry = flow_upsert(&flow, nfct_attr_is_set(ct, ATTR_ORIG_COUNTER_BYTES));
+        entry->dirty = 1;
+    }
+
+    return NFCT_CB_CONTINUE;
+}
+
+static int refresh_cb(enum nf_conntrack_msg_type type,
+                      struct nf_conntrack *ct,
+                      void *data)
+{
+    struct RefreshTarget *target = data;
+    struct FlowEntry *entry;
+    struct Flow flow;
+
+    type = type; // get compiler to ignore that we don't use this param
+
+    if (ct == NULL)
+        return NFCT_CB_CONTINUE;
+
+    ct2flow(ct, &flow);
+    flow.time_seen = monotonic_ns();
+
+    if (target->entry != NULL) {
+        // queryEvents() walks the table meanwhile: nothing is inserted, and a newer conntrack
+        // reusing the tuple is left to its NEW event
+        if (flow.id != target->entry->flow.id) {
+            target->replaced = 1;
+            return NFCT_CB_CONTINUE;
+        }
+        entry = target->entry;
+        flow_update(entry, &flow, 1);
+    } else {
+        entry = flow_upsert(&flow, 1);
+    }
+    entry->generation = flow_generation;
+    flow_refreshed(entry);
+
+    return NFCT_CB_CONTINUE;
+}
+
+/* opens the event subscription and the query handle used for event mode (-e) */
+int eventsOpen() {
+    int fd;
+
+    event_handle = nfct_open(CONNTRACK, NF_NETLINK_CONNTRACK_NEW | NF_NETLINK_CONNTRACK_UPDATE | NF_NETLINK_CONNTRACK_DESTROY);
+    if (!event_handle) {
+        perror("nfct_open");
+        return -1;
+    }
+
+    fd = nfct_fd(event_handle);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // bursts of churn are absorbed by the socket between two drains; NETLINK_NO_ENOBUFS is
+    // deliberately left off here, as the ENOBUFS is what tells eventsDrain() that events were lost
+    set_rcvbuf(fd, NFTOP_U_RCVBUF > 0 ? NFTOP_U_RCVBUF : NFTOP_EVENT_RCVBUF);
+
+    nfct_callback_register(event_handle, NFCT_T_ALL, event_cb, NULL);
+
+    query_handle = nfct_open(CONNTRACK, 0);
+    if (!query_handle) {
+        perror("nfct_open");
+        eventsClose();
+        return -1;
+    }
+    nfct_callback_register(query_handle, NFCT_T_ALL, refresh_cb, &query_target);
+
+    if (NFTOP_U_RCVBUF > 0)
+        set_rcvbuf(nfct_fd(query_handle), NFTOP_U_RCVBUF);
+
+    if (!(query_ct = nfct_new())) {
+        perror("nfct_new");
+        eventsClose();
+        return -1;
+    }
+
+    flow_table_grow();
+    event_resync = 1;
+
+    return 0;
+}
+
+/* process all pending conntrack events without blocking */
+void eventsDrain() {
+    if (event_handle == NULL)
+        return;
+
+    if (catch_pending(event_handle)) {
+        // events were lost; the table is re-synchronized with a full dump
+        DLOG(NFTOP_FLAGS_DEBUG, "event socket overrun; scheduling resync\n");
+        event_resync = 1;
+    }
+}
+
+/* query the counters of a single flow by its original tuple; returns -1 with errno ENOENT if the flow is gone */
+static int refresh_flow(struct nfct_handle *h, struct nf_conntrack *ct, const struct Flow *flow) {
+    nfct_set_attr_u8(ct, ATTR_L3PROTO, flow->proto_l3);
+    nfct_set_attr_u8(ct, ATTR_L4PROTO, flow->proto_l4);
+    nfct_set_attr_u16(ct, ATTR_ZONE, flow->zone);
+
+    if (flow->proto_l3 == AF_INET) {
+        nfct_set_attr(ct, ATTR_ORIG_IPV4_SRC, &flow->orig_src);
+        nfct_set_attr(ct, ATTR_ORIG_IPV4_DST, &flow->orig_dst);
+    } else {
+        nfct_set_attr(ct, ATTR_ORIG_IPV6_SRC, &flow->orig_src);
+        nfct_set_attr(ct, ATTR_ORIG_IPV6_DST, &flow->orig_dst);
+    }
+
+    if (flow->proto_l4 == IPPROTO_ICMP || flow->proto_l4 == IPPROTO_ICMPV6) {
+        nfct_set_attr_u16(ct, ATTR_ICMP_ID, flow->orig_sport);
+        nfct_set_attr_u8(ct, ATTR_ICMP_TYPE, flow->orig_dport >> 8);
+        nfct_set_attr_u8(ct, ATTR_ICMP_CODE, flow->orig_dport & 0xff);
+    } else {
+        nfct_set_attr_u16(ct, ATTR_ORIG_PORT_SRC, flow->orig_sport);
+        nfct_set_attr_u16(ct, ATTR_ORIG_PORT_DST, flow->orig_dport);
+    }
+
+    return nfct_query(h, NFCT_Q_GET, ct);
+}
+
+/*
+ * event mode counterpart of queryNFCT(): the live table is kept current by events, only flows that
+ * changed or moved traffic since the last interval have their counters refreshed (NFCT_Q_GET), and a
+ * full dump is issued every NFTOP_U_EVENT_RESYNC intervals or after the event socket overran.
+ */
+int queryEvents(struct Connections *conns) {
+    struct FlowEntry **slot;
+    struct nfct_filter_dump *filter;
+    size_t i;
+    int ret = 0, gone;
+
+    eventsDrain();
+
+    NFTOP_DUMP_PARTIAL = 0;
+
+    for (i = 0; i < flow_table_size; i++) {
+        for (slot = &flow_table[i]; *slot != NULL; slot = &(*slot)->next)
+            (*slot)->refreshed = 0;
+    }
+
+    if (event_resync || ++event_iter >= NFTOP_U_EVENT_RESYNC) {
+        event_resync = 0;
+        event_iter = 0;
+        flow_generation++;
+
+        filter = create_dump_filter();
+        ret = nfct_query(query_handle, NFCT_Q_DUMP_FILTER, filter);
+        nfct_filter_dump_destroy(filter);
+        if (ret == -1) {
+            if (errno != ENOBUFS) {
+                displayClose();
+                fprintf(stderr, "error: (%d)(%s)\n", ret, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            // retried on the next interval; the table is kept as is until then
+            event_resync = 1;
+            NFTOP_DUMP_PARTIAL = 1;
+        } else {
+            // drop entries whose DESTROY event was lost
+            for (i = 0; i < flow_table_size; i++) {
+                slot = &flow_table[i];
+                while (*slot != NULL) {
+                    if ((*slot)->generation != flow_generation) {
+                        flow_unlink(slot);
+                    } else {
+                        slot = &(*slot)->next;
+                    }
+                }
+            }
+        }
+    } else {
+        for (i = 0; i < flow_table_size; i++) {
+            slot = &flow_table[i];
+            while (*slot != NULL) {
+                if (((*slot)->dirty || (*slot)->active) && !(*slot)->refreshed) {
+                    query_target.entry = *slot;
+                    query_target.replaced = 0;
+                    gone = refresh_flow(query_handle, query_ct, &(*slot)->flow) == -1 && errno == ENOENT;
+                    query_target.entry = NULL;
+                    if (gone || query_target.replaced) {
+                        flow_unlink(slot);
+                        continue;
+                    }
+                }
+                slot = &(*slot)->next;
+            }
+        }
+    }
+
+    for (i = 0; i < flow_table_size; i++) {
+        for (slot = &flow_table[i]; *slot != NULL; slot = &(*slot)->next) {
+            if ((*slot)->refreshed || NFTOP_U_THRESH < 1)
+                append_flow(conns, &(*slot)->flow);
+        }
+    }
+
+    append_closed(conns);
+
+    NFTOP_CT_COUNT = flow_table_count;
+
+    return ret;
+}
+
+void eventsClose() {
+    if (event_handle != NULL) {
+        nfct_callback_unregister(event_handle);
+        nfct_close(event_handle);
+        event_handle = NULL;
+    }
+
+    if (query_handle != NULL) {
+        nfct_callback_unregister(query_handle);
+        nfct_close(query_handle);
+        query_handle = NULL;
+    }
+
+    if (query_ct != NULL) {
+        nfct_destroy(query_ct);
+        query_ct = NULL;
+    }
+
+    flow_table_free();
+}
+
+/* parses "proto,src,sport,dst,dport", the original direction of a flow; for ICMP, sport is the ID and dport type << 8 | code */
+static int watch_parse(const char *spec, struct Flow *flow) {
+    char buf[256], *field[5], *tok, *end, *save = NULL;
+    struct protoent *proto;
+    unsigned long port[2];
+    int n = 0, i;
+
+    if (strlen(spec) >= sizeof(buf))
+        return -1;
+    strcpy(buf, spec);
+
+    for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        if (n == 5)
+            return -1;
+        field[n++] = tok;
+    }
+    if (n != 5)
+        return -1;
+
+    memset(flow, 0, sizeof(struct Flow));
+
+    // the l4 protocol by name (tcp, udp, ...) or number
+    if ((proto = getprotobyname(field[0])) != NULL) {
+        flow->proto_l4 = proto->p_proto;
+    } else {
+        port[0] = strtoul(field[0], &end, 0);
+        if (*end != '\0' || end == field[0] || port[0] > 255)
+            return -1;
+        flow->proto_l4 = port[0];
+    }
+
+    if (inet_pton(AF_INET, field[1], &flow->orig_src) == 1 && inet_pton(AF_INET, field[3], &flow->orig_dst) == 1) {
+        flow->proto_l3 = AF_INET;
+    } else if (inet_pton(AF_INET6, field[1], &flow->orig_src) == 1 && inet_pton(AF_INET6, field[3], &flow->orig_dst) == 1) {
+        flow->proto_l3 = AF_INET6;
+    } else {
+        return -1;
+    }
+
+    if (flow->proto_l3 == AF_INET6 && flow->proto_l4 == IPPROTO_ICMP)
+        flow->proto_l4 = IPPROTO_ICMPV6;
+
+    for (i = 0; i < 2; i++) {
+        port[i] = strtoul(field[2 + i * 2], &end, 0);
+        if (*end != '\0' || end == field[2 + i * 2] || port[i] > 65535)
+            return -1;
+    }
+
+    flow->orig_sport = htons(port[0]);
+    // the ICMP type/code pair is kept in host order, as ct2flow() builds it
+    if (flow->proto_l4 == IPPROTO_ICMP || flow->proto_l4 == IPPROTO_ICMPV6)
+        flow->orig_dport = port[1];
+    else
+        flow->orig_dport = htons(port[1]);
+
+    flow->zone = NFTOP_U_ZONE > 0 ? NFTOP_U_ZONE : 0;
+
+    return 0;
+}
+
+/* stores the reply to a watch query (or the dumped entry with the watched ID) */
+static int watch_cb(enum nf_conntrack_msg_type type,
+                    struct nf_conntrack *ct,
+                    void *data)
+{
+    struct Flow flow;
+    uint32_t *id = (uint32_t *) data;
+
+    type = type; // get compiler to ignore that we don't use this param
+
+    if (ct == NULL)
+        return NFCT_CB_CONTINUE;
+
+    ct2flow(ct, &flow);
+    if (id != NULL && flow.id != *id)
+        return NFCT_CB_CONTINUE;
+
+    flow.time_seen = monotonic_ns();
+    memcpy(&watch_flow, &flow, sizeof(struct Flow));
+
+    // the rest of a dump is read all the same, or it would be taken for the answer to the first query
+    return NFCT_CB_CONTINUE;
+}
+
+/*
+ * prepares watch mode (-W) for a flow given by conntrack ID or by tuple (see watch_parse()); ctnetlink
+ * only looks flows up by tuple, so the tuple of an ID is taken from a single dump of the table
+ */
+int watchOpen(const char *spec) {
+    struct nfct_filter_dump *filter;
+    unsigned long id;
+    uint32_t id32;
+    char *end;
+
+    watch_handle = nfct_open(CONNTRACK, 0);
+    if (!watch_handle) {
+        perror("nfct_open");
+        return -1;
+    }
+
+    if (!(watch_ct = nfct_new())) {
+        perror("nfct_new");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&watch_flow, 0, sizeof(struct Flow));
+
+    id = strtoul(spec, &end, 0);
+    if (end != spec && *end == '\0') {
+        id32 = id;
+        nfct_callback_register(watch_handle, NFCT_T_ALL, watch_cb, &id32);
+        filter = create_dump_filter();
+        nfct_query(watch_handle, NFCT_Q_DUMP_FILTER, filter);
+        nfct_filter_dump_destroy(filter);
+        nfct_callback_unregister(watch_handle);
+
+        if (watch_flow.id != id32 || id32 == 0) {
+            fprintf(stderr, "No connection with ID %lu\n", id);
+            watchClose();
+            return -1;
+        }
+    } else if (watch_parse(spec, &watch_flow) == -1) {
+        fprintf(stderr, "Option -W requires a connection ID or a tuple in the form proto,src,sport,dst,dport\n");
+        watchClose();
+        return -1;
+    }
+
+    nfct_callback_register(watch_handle, NFCT_T_ALL, watch_cb, NULL);
+
+    // a tuple without a flow is reported now, rather than as a flow that went away
+    if (refresh_flow(watch_handle, watch_ct, &watch_flow) == -1) {
+        if (errno == ENOENT)
+            fprintf(stderr, "No connection matching %s\n", spec);
+        else
+            perror("nfct_query");
+        watchClose();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* polls the watched flow with a single NFCT_Q_GET; returns -1 with errno ENOENT once the flow is gone */
+int queryWatch(struct Flow *flow) {
+    if (refresh_flow(watch_handle, watch_ct, &watch_flow) == -1)
+        return -1;
+
+    memcpy(flow, &watch_flow, sizeof(struct Flow));
+
+    return 0;
+}
+
+void watchClose() {
+    if (watch_handle != NULL) {
+        nfct_callback_unregister(watch_handle);
+        nfct_close(watch_handle);
+        watch_handle = NULL;
+    }
+
+    if (watch_ct != NULL) {
+        nfct_destroy(watch_ct);
+        watch_ct = NULL;
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_CONNTRACK_H
+#define _NFTOP_CONNTRACK_H
+
+#define NFTOP_FLOW_BUCKETS      65536       // initial size of the event mode flow table
+#define NFTOP_EVENT_RCVBUF      (8 << 20)   // receive buffer of the event socket
+#define NFTOP_DUMP_BUFSIZ       MNL_SOCKET_DUMP_SIZE    // dump receive buffer, allocated once
+#define NFTOP_DUMP_MAX_RETRIES  3           // dump restarts after ENOBUFS before keeping a partial dump
+#define NFTOP_DUMP_RCVBUF_MAX   (256 << 20) // receive buffer growth limit of the dump sockets
+#define NFTOP_CLOSED_RING       4096        // recently closed flows kept for accounting (-C)
+#define NFTOP_PARTITION_SIZE    4096        // initial number of flows in a collector's partition
+#define NFTOP_MAX_SHARDS        256         // shards a mark mask (-H) may split the table into
+#define NFTOP_WATCH_INTERVAL    0.1         // poll interval of watch mode (-W) unless set with -u
+#define NFTOP_WATCH_HISTORY     512         // polls kept for the rate graph of watch mode
+
+int flow2connection(const struct Flow *, struct Connections *, uint32_t);
+struct ConnectionInfo *connectionInfo(struct Connections *, uint32_t);
+void connectionServices(struct Connections *, uint32_t);
+int openNFCT();
+int queryNFCT(struct Connections *);
+int queryProc(struct Connections *, const char *);
+void closeNFCT();
+
+int eventsOpen();
+void eventsDrain();
+int queryEvents(struct Connections *);
+void eventsClose();
+
+void queryStats();
+void closeStats();
+
+int closedOpen();
+void closedDrain();
+void closedClose();
+
+int watchOpen(const char *);
+int queryWatch(struct Flow *);
+void watchClose();
+
+#endif
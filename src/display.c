@@ -7,12 +7,17 @@
  * (at your option) any later version.
  */
 #include <stdlib.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
+#include <arpa/inet.h>
+#include <linux/netfilter/nf_conntrack_common.h>  // IPS_*
 
 #include "nftop.h"
 #include "util.h"
 #include "display.h"
+#include "netns.h"
+#include "intern.h"
 
 enum NFTOP_F_COLUMNS {
     NFTOP_FLAGS_COL_ID      = (1u << 0),
@@ -144,8 +149,16 @@ void getwinsize(struct winsize w, short unsigned int *_max_y, short unsigned int
 }
 
 void displayHeader() {
-    char *rx_all_s, *tx_all_s, *sum_all_s, *run_status, *uom, *bb, *l3enabled;
+    char rx_all_s[NFTOP_UOM_LEN], tx_all_s[NFTOP_UOM_LEN], sum_all_s[NFTOP_UOM_LEN];
+    char *run_status, *uom, *bb, *l3enabled;
     char *pad = " ";
+    char dump_status[32] = "";
+    char shard_status[24] = "";
+    char cost_status[40] = "";
+    char interval_str[16];
+    char netns_status[NFTOP_NETNS_NAMESIZ + 16] = "";
+    char count_str[32], pressure_status[64] = "";
+    int extra_len;  // width of the header fields beyond the default layout
 
 #ifdef ENABLE_NCURSES
     int max_x, max_y;
@@ -180,14 +193,21 @@ void displayHeader() {
     if (NFTOP_MAX_HOSTNAME < 10)
         NFTOP_MAX_HOSTNAME = 10;
 
-    rx_all_s = formatUOM(NFTOP_RX_ALL);
-    tx_all_s = formatUOM(NFTOP_TX_ALL);
-    sum_all_s = formatUOM(NFTOP_TX_ALL + NFTOP_RX_ALL);
+    formatUOM(NFTOP_RX_ALL, rx_all_s, sizeof(rx_all_s));
+    formatUOM(NFTOP_TX_ALL, tx_all_s, sizeof(tx_all_s));
+    formatUOM(NFTOP_TX_ALL + NFTOP_RX_ALL, sum_all_s, sizeof(sum_all_s));
 
     if (!NFTOP_FLAGS_PAUSE)
         displayClear();
 
-    displayWrite("[NFTOP] Connections: %-5d |", NFTOP_CT_COUNT);
+    // the table size as reported by the kernel; the number of dumped entries on kernels without ctnetlink stats
+    if (NFTOP_CT_STATS.valid && NFTOP_CT_STATS.max_entries)
+        snprintf(count_str, sizeof(count_str), "%u/%u", NFTOP_CT_STATS.entries, NFTOP_CT_STATS.max_entries);
+    else if (NFTOP_CT_STATS.valid)
+        snprintf(count_str, sizeof(count_str), "%u", NFTOP_CT_STATS.entries);
+    else
+        snprintf(count_str, sizeof(count_str), "%d", NFTOP_CT_COUNT);
+    displayWrite("[NFTOP] Connections: %-5s |", count_str);
 
     if (NFTOP_FLAGS_PAUSE) {
         run_status = " PAUSED  ";
@@ -213,11 +233,50 @@ void displayHeader() {
         uom = "| IEC ";
 
     displayWrite("%-9s", run_status);
-    displayWrite("| %03ds ", NFTOP_U_INTERVAL);
+    // the effective interval, which --cpu-budget may stretch beyond -u
+    if (NFTOP_INTERVAL == (int)NFTOP_INTERVAL)
+        snprintf(interval_str, sizeof(interval_str), "%03d", (int)NFTOP_INTERVAL);
+    else
+        snprintf(interval_str, sizeof(interval_str), "%.3g", NFTOP_INTERVAL);
+    displayWrite("| %ss ", interval_str);
     displayWrite("%-5s", bb);
     displayWrite("%-5s", l3enabled);
     displayWrite("%-5s", uom);
 
+    // only shown when the table is under pressure; the padding below absorbs its width
+    if (NFTOP_DUMP_PARTIAL)
+        snprintf(dump_status, sizeof(dump_status), "| PARTIAL (%d retries) ", NFTOP_DUMP_RETRIES);
+    else if (NFTOP_DUMP_RETRIES)
+        snprintf(dump_status, sizeof(dump_status), "| %d retries ", NFTOP_DUMP_RETRIES);
+    // entries refused or evicted by a full table during the last interval
+    if (NFTOP_CT_STATS.valid) {
+        snprintf(pressure_status, sizeof(pressure_status), "| drop/early/ifail: %" PRIu64 "/%" PRIu64 "/%" PRIu64 " ",
+            NFTOP_CT_STATS.drop_delta, NFTOP_CT_STATS.early_drop_delta, NFTOP_CT_STATS.insert_failed_delta);
+        displayWrite("%s", pressure_status);
+    }
+
+    // CPU used by the last update cycle, against the budget
+    if (NFTOP_U_CPU_BUDGET > 0) {
+        snprintf(cost_status, sizeof(cost_status), "| cost: %.1fms %.1f%%%s ",
+            NFTOP_CYCLE_CPU / 1e6, NFTOP_CYCLE_LOAD, NFTOP_FLAGS_SKIP_DNS ? " nodns" : "");
+        displayWrite("%s", cost_status);
+    }
+
+    if (NFTOP_DUMP_SHARDS > 1) {
+        snprintf(shard_status, sizeof(shard_status), "| shard %d/%d ", NFTOP_DUMP_SHARD + 1, NFTOP_DUMP_SHARDS);
+        displayWrite("%s", shard_status);
+    }
+
+    if (netnsConfigured()) {
+        snprintf(netns_status, sizeof(netns_status), "| netns: %s ",
+            NFTOP_U_NETNS_VIEW >= 0 ? netnsName(NFTOP_U_NETNS_VIEW) : "all");
+        displayWrite("%s", netns_status);
+    }
+    extra_len = strlen(dump_status) + strlen(cost_status) + strlen(shard_status) + strlen(netns_status) + strlen(pressure_status) + strlen(interval_str) - 3;
+    if (strlen(count_str) > 5)
+        extra_len += strlen(count_str) - 5;
+    displayWrite("%s", dump_status);
+
     if (!NFTOP_FLAGS_DEV_ONLY) {
         if (NFTOP_U_DISPLAY_ID)
             displayWrite("%*s", (NFTOP_U_REPORT_WIDE ? 11 : 11), pad);
@@ -227,9 +286,9 @@ void displayHeader() {
 
     if (NFTOP_U_REPORT_WIDE || NFTOP_FLAGS_DEV_ONLY) {
         if (NFTOP_U_DISPLAY_AGE == 0) {
-            displayWrite("%*s", (NFTOP_MAX_HOSTNAME - 3), pad);
+            displayWrite("%*s", (NFTOP_MAX_HOSTNAME - 3 - extra_len), pad);
         } else {
-            displayWrite("%*s", (NFTOP_MAX_HOSTNAME - 14), pad);
+            displayWrite("%*s", (NFTOP_MAX_HOSTNAME - 14 - extra_len), pad);
         }
 
         NFTOP_MAX_HOSTNAME = (NFTOP_MAX_HOSTNAME - 4) / 2;
@@ -242,7 +301,7 @@ void displayHeader() {
         displayWrite("%13s", sum_all_s);
     } else {
         if (!NFTOP_FLAGS_DEV_ONLY) {
-            displayWrite("%*s", (NFTOP_MAX_HOSTNAME-25), pad);
+            displayWrite("%*s", (NFTOP_MAX_HOSTNAME - 25 - extra_len), pad);
         }
 
         displayWrite("%12s ", tx_all_s);
@@ -329,17 +388,47 @@ void displayHeader() {
     displayWrite("\n");
 
     displayRefresh();
+}
 
-    free(rx_all_s);
-    free(tx_all_s);
-    free(sum_all_s);
+/* device name as displayed; prefixed with the namespace name when collecting from several (-X) */
+static const char *dev_label(uint16_t netns, const char *name, char *label, size_t len) {
+    if (!netnsConfigured())
+        return name;
+
+    snprintf(label, len, "%s/%s", netnsName(netns), name);
+    return label;
 }
 
-void displayCTInfo(struct Connection *ct_info) {
-    char *age, *pad = " ";
+/* the connections displayCTInfo() shows below the header, at most max; max when not on a terminal */
+int displayRows(int max) {
+    int rows;
+#ifdef ENABLE_NCURSES
+    int max_x, max_y;
+#else
+    short unsigned int max_y, max_x;
+#endif
+
+    if (is_redirected() || NFTOP_U_CONTINUOUS)
+        return max;
+
+    getwinsize(w, &max_y, &max_x);
+
+    // as displayCTInfo() counts the lines: a row takes one line in the wide report, two otherwise
+    rows = (int)max_y - (NFTOP_U_REPORT_WIDE ? 4 : 5);
+    rows = rows < 0 ? 0 : rows / (NFTOP_U_REPORT_WIDE ? 1 : 2) + 1;
+
+    return rows < max ? rows : max;
+}
+
+void displayCTInfo(const struct Connections *conns, uint32_t ct) {
+    char age[32], *pad = " ";
+    char in_label[17], out_label[17];   // the device columns are 16 wide
     char *format = "%4dd %2dh %2dm %2ds";
-    int length, days, hours, minutes = 0;
-    int seconds = ct_info->delta;
+    int days, hours, minutes = 0;
+    int seconds = conns->delta[ct];
+    struct ConnectionInfo *info = conns->info[ct];
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    const char *host_src, *host_dst;
 
 #ifdef ENABLE_NCURSES
     int max_x, max_y;
@@ -349,7 +438,7 @@ void displayCTInfo(struct Connection *ct_info) {
 #endif
 
     getwinsize(w, &max_y, &max_x);
-    char *rx_s, *tx_s, *sum_s, *proto_name;
+    char rx_s[NFTOP_UOM_LEN], tx_s[NFTOP_UOM_LEN], sum_s[NFTOP_UOM_LEN], proto_name[NFTOP_PROTO_LEN];
 
     if (is_redirected()) { // override the max rows/cols if writing to screen/file/pager/etc
         max_x = 9999;
@@ -362,103 +451,101 @@ void displayCTInfo(struct Connection *ct_info) {
 
     NFTOP_CT_ITER += (1 + (NFTOP_U_REPORT_WIDE ? 0 : 1));
 
-	ct_info->status_str = '\0';
+	info->status_str = '\0';
 
-	if (ct_info->bps_sum >= NFTOP_U_THRESH) {
+	if (conns->bps_sum[ct] >= NFTOP_U_THRESH) {
         if (NFTOP_U_DISPLAY_STATUS) {
-            if ((!(ct_info->status & IPS_SEEN_REPLY))) {
-                ct_info->status_str = "UNREPLIED";
+            if ((!(conns->status[ct] & IPS_SEEN_REPLY))) {
+                info->status_str = "UNREPLIED";
             } else {
-                if (ct_info->status & IPS_UNTRACKED) {
-                    ct_info->status_str = "UNTRACKED";
-                } else if (ct_info->status & IPS_ASSURED) {
-                    ct_info->status_str = "ASSURED";
-                } else if (ct_info->status & IPS_CONFIRMED) {
-                    ct_info->status_str = "CONFIRMED";
+                if (conns->status[ct] & IPS_UNTRACKED) {
+                    info->status_str = "UNTRACKED";
+                } else if (conns->status[ct] & IPS_ASSURED) {
+                    info->status_str = "ASSURED";
+                } else if (conns->status[ct] & IPS_CONFIRMED) {
+                    info->status_str = "CONFIRMED";
                 }
             }
 
-            if (ct_info->status_l4 != 0) {
-                switch(ct_info->status_l4) {
+            if (conns->status_l4[ct] != 0) {
+                switch(conns->status_l4[ct]) {
                     case TCP_CONNTRACK_TIME_WAIT:
-                        ct_info->status_str = "TIME_WAIT";
+                        info->status_str = "TIME_WAIT";
                         break;
                     case TCP_CONNTRACK_CLOSE:
-                        ct_info->status_str = "CLOSE";
+                        info->status_str = "CLOSE";
                         break;
                     case TCP_CONNTRACK_CLOSE_WAIT:
-                        ct_info->status_str = "CLOSE_WAIT";
+                        info->status_str = "CLOSE_WAIT";
                         break;
                     case TCP_CONNTRACK_FIN_WAIT:
-                        ct_info->status_str = "FIN_WAIT";
+                        info->status_str = "FIN_WAIT";
                         break;
                     case TCP_CONNTRACK_SYN_SENT:
                     case TCP_CONNTRACK_SYN_SENT2:
-                        ct_info->status_str = "SYN_SENT";
+                        info->status_str = "SYN_SENT";
                         break;
                 }
             }
         }
 
-        tx_s = formatUOM(ct_info->bps_tx);
-        rx_s = formatUOM(ct_info->bps_rx);
-        sum_s = formatUOM(ct_info->bps_sum);
-        proto_name = getIPProtocolName(ct_info->proto_l3, ct_info->proto_l4);
+        formatUOM(conns->bps_tx[ct], tx_s, sizeof(tx_s));
+        formatUOM(conns->bps_rx[ct], rx_s, sizeof(rx_s));
+        formatUOM(conns->bps_sum[ct], sum_s, sizeof(sum_s));
+        getIPProtocolName(conns->proto_l3[ct], conns->proto_l4[ct], proto_name, sizeof(proto_name));
 
         if (NFTOP_U_DISPLAY_ID)
-            displayWrite("%11u", ct_info->id);
-
-        if (NFTOP_U_REDACT_SRC || NFTOP_U_REDACT_DST) {
-            if (NFTOP_U_REDACT_SRC) {
-                strcpy(ct_info->local.hostname_src, "REDACTED");
-                strcpy(ct_info->local.src,          "REDACTED");
-            }
-
-            if (NFTOP_U_REDACT_DST) {
-                strcpy(ct_info->local.hostname_dst, "REDACTED");
-                strcpy(ct_info->local.dst,           "REDACTED");
-            }
-        } else {
-            // truncate the hostname_dst/src to NTOP_MAX_HOSTNAME
-            if (strlen(ct_info->local.hostname_src) > NFTOP_MAX_HOSTNAME)
-                ct_info->local.hostname_src[NFTOP_MAX_HOSTNAME] = '\0';
-            if (strlen(ct_info->local.hostname_dst) > NFTOP_MAX_HOSTNAME)
-                ct_info->local.hostname_dst[NFTOP_MAX_HOSTNAME] = '\0';
-            if (strlen(ct_info->local.src) > NFTOP_MAX_HOSTNAME)
-                ct_info->local.src[NFTOP_MAX_HOSTNAME] = '\0';
-            if (strlen(ct_info->local.dst) > NFTOP_MAX_HOSTNAME)
-                ct_info->local.dst[NFTOP_MAX_HOSTNAME] = '\0';
-        }
+            displayWrite("%11u", conns->id[ct]);
+
+        // the addresses are formatted for the rows displayed only
+        inet_ntop(conns->proto_l3[ct], &conns->addrs[ct].orig_src, src, sizeof(src));
+        inet_ntop(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, dst, sizeof(dst));
+
+        // the host names unless redacted, numeric or unresolved; cut to NFTOP_MAX_HOSTNAME when written
+        if (NFTOP_U_REDACT_SRC)
+            host_src = "REDACTED";
+        else if (info->hostname_src != 0 && NFTOP_U_NUMERIC_SRC == 0)
+            host_src = internedString(info->hostname_src);
+        else
+            host_src = src;
+
+        if (NFTOP_U_REDACT_DST)
+            host_dst = "REDACTED";
+        else if (info->hostname_dst != 0 && NFTOP_U_NUMERIC_DST == 0)
+            host_dst = internedString(info->hostname_dst);
+        else
+            host_dst = dst;
 
         if (NFTOP_U_REPORT_WIDE) {
-            displayWrite(" %-16s %-16s %-7s %-*s ",
-                ct_info->net_in_dev.name, ct_info->net_out_dev.name,
-                proto_name, (NFTOP_MAX_HOSTNAME), (*ct_info->local.hostname_src != '\0' && NFTOP_U_NUMERIC_SRC == 0) ? ct_info->local.hostname_src : ct_info->local.src);
-                if (NFTOP_U_NUMERIC_PORT || strlen(ct_info->local.sport_str) < 1) {
-                    displayWrite("%8u ", ct_info->local.sport);
+            displayWrite(" %-16s %-16s %-7s %-*.*s ",
+                dev_label(conns->netns[ct], internedString(info->net_in_dev), in_label, sizeof(in_label)),
+                dev_label(conns->netns[ct], internedString(info->net_out_dev), out_label, sizeof(out_label)),
+                proto_name, (int)NFTOP_MAX_HOSTNAME, (int)NFTOP_MAX_HOSTNAME, host_src);
+                if (NFTOP_U_NUMERIC_PORT || info->sport_str == 0) {
+                    displayWrite("%8u ", conns->sport[ct]);
                 } else {
-                    displayWrite("%8s ", ct_info->local.sport_str);
+                    displayWrite("%8s ", internedString(info->sport_str));
                 }
         } else {
-            displayWrite(" %-16s %-7s %-*s ",
-                ct_info->net_in_dev.name,
-                proto_name, (NFTOP_MAX_HOSTNAME), (*ct_info->local.hostname_src != '\0' && NFTOP_U_NUMERIC_SRC == 0) ? ct_info->local.hostname_src : ct_info->local.src);
-            if (NFTOP_U_NUMERIC_PORT || strlen(ct_info->local.sport_str) < 1) {
-                displayWrite("%8u ", ct_info->local.sport);
+            displayWrite(" %-16s %-7s %-*.*s ",
+                dev_label(conns->netns[ct], internedString(info->net_in_dev), in_label, sizeof(in_label)),
+                proto_name, (int)NFTOP_MAX_HOSTNAME, (int)NFTOP_MAX_HOSTNAME, host_src);
+            if (NFTOP_U_NUMERIC_PORT || info->sport_str == 0) {
+                displayWrite("%8u ", conns->sport[ct]);
             } else {
-                displayWrite("%8s ", ct_info->local.sport_str);
+                displayWrite("%8s ", internedString(info->sport_str));
             }
         }
 
         if (NFTOP_U_DISPLAY_STATUS)
-            displayWrite("[%-10s] ", ct_info->status_str);
+            displayWrite("[%-10s] ", info->status_str);
 
         if (NFTOP_U_REPORT_WIDE) {
-            displayWrite("%-*s ", (NFTOP_MAX_HOSTNAME), (*ct_info->local.hostname_dst != '\0' && NFTOP_U_NUMERIC_DST == 0) ? ct_info->local.hostname_dst : ct_info->local.dst);
-            if (NFTOP_U_NUMERIC_PORT || strlen(ct_info->local.dport_str) < 1) {
-                displayWrite("%8u ", ct_info->local.dport);
+            displayWrite("%-*.*s ", (int)NFTOP_MAX_HOSTNAME, (int)NFTOP_MAX_HOSTNAME, host_dst);
+            if (NFTOP_U_NUMERIC_PORT || info->dport_str == 0) {
+                displayWrite("%8u ", conns->dport[ct]);
             } else {
-                displayWrite("%8s ", ct_info->local.dport_str);
+                displayWrite("%8s ", internedString(info->dport_str));
             }
         }
 
@@ -470,22 +557,16 @@ void displayCTInfo(struct Connection *ct_info) {
 
         switch(NFTOP_U_DISPLAY_AGE) {
             case 1:
-                length = snprintf(NULL, 0, "%ld", ct_info->delta); // get length of digits in ct_info->delta
-                age = malloc(length + 1);
-                snprintf(age, length+1, "%ld", ct_info->delta);
+                snprintf(age, sizeof(age), "%ld", conns->delta[ct]);
                 displayWrite(" %10ss\n", age);
-                free(age);
                 break;
             case 2:
                 days 	= seconds / (24 * 3600);
                 hours 	= ((seconds - (24 * 3600)*days)) / 3600;
                 minutes = ((seconds - (24 * 3600)*days) - (3600*hours)) / 60;
                 seconds = ((seconds - (24 * 3600)*days) - (3600*hours) - (60*minutes));
-                length 	= snprintf(NULL, 0, format, days, hours, minutes, seconds);
-                age = malloc(length + 1);
-                snprintf(age, length+1, format, days, hours, minutes, seconds);
+                snprintf(age, sizeof(age), format, days, hours, minutes, seconds);
                 displayWrite(" %s\n", age);
-                free(age);
                 break;
             default:
                 displayWrite("\n");
@@ -495,12 +576,12 @@ void displayCTInfo(struct Connection *ct_info) {
             if (NFTOP_U_DISPLAY_ID)
                 displayWrite("%11s", pad);
 
-            displayWrite("  -> %-14s",  ct_info->net_out_dev.name);
-            displayWrite("%6s   -> %-*s ", pad, (NFTOP_MAX_HOSTNAME - 5), (*ct_info->local.hostname_dst != '\0' && NFTOP_U_NUMERIC_DST == 0) ? ct_info->local.hostname_dst : ct_info->local.dst);
-            if (NFTOP_U_NUMERIC_PORT || strlen(ct_info->local.dport_str) < 1) {
-                displayWrite("%8u", ct_info->local.dport);
+            displayWrite("  -> %-14s",  dev_label(conns->netns[ct], internedString(info->net_out_dev), out_label, 15));
+            displayWrite("%6s   -> %-*.*s ", pad, (int)NFTOP_MAX_HOSTNAME - 5, (int)NFTOP_MAX_HOSTNAME, host_dst);
+            if (NFTOP_U_NUMERIC_PORT || info->dport_str == 0) {
+                displayWrite("%8u", conns->dport[ct]);
             } else {
-                displayWrite("%8s", ct_info->local.dport_str);
+                displayWrite("%8s", internedString(info->dport_str));
             }
             if (NFTOP_U_DISPLAY_STATUS) {
                 displayWrite("%13s", pad);
@@ -508,19 +589,16 @@ void displayCTInfo(struct Connection *ct_info) {
             displayWrite("%13s\n", rx_s);
 
         }
-
-        free(tx_s);
-        free(rx_s);
-        free(sum_s);
-        free(proto_name);
 	}
 }
 
 void displayDevices(struct Interface *devices_m) {
     struct Interface *curr_dev;
-    char *rx_is, *tx_is, *sum_is, // interface counters
-         *rx_as, *tx_as, *sum_as, // address counters
+    char rx_is[NFTOP_UOM_LEN], tx_is[NFTOP_UOM_LEN], sum_is[NFTOP_UOM_LEN], // interface counters
+         rx_as[NFTOP_UOM_LEN], tx_as[NFTOP_UOM_LEN], sum_as[NFTOP_UOM_LEN], // address counters
          *pad = " ";
+    char label[17];
+    const char *name;
 
     displayWrite("\033[0m\033[J"); // reset formating and clear to end of screen
 
@@ -528,39 +606,134 @@ void displayDevices(struct Interface *devices_m) {
         if ((curr_dev->flags & IFF_LOOPBACK) && NFTOP_U_NO_LOOPBACK == 1) {
             continue;
         }
-        tx_is = formatUOM(curr_dev->bps_tx);
-        rx_is = formatUOM(curr_dev->bps_rx);
-        sum_is = formatUOM(curr_dev->bps_sum);
+        if (NFTOP_U_NETNS_VIEW >= 0 && curr_dev->netns != NFTOP_U_NETNS_VIEW) {
+            continue;
+        }
+        name = dev_label(curr_dev->netns, curr_dev->name, label, sizeof(label));
+        formatUOM(curr_dev->bps_tx, tx_is, sizeof(tx_is));
+        formatUOM(curr_dev->bps_rx, rx_is, sizeof(rx_is));
+        formatUOM(curr_dev->bps_sum, sum_is, sizeof(sum_is));
 
         if (curr_dev->n_addresses < 2) {
-            displayWrite("%-16s %-*s %12s %12s %13s\n", curr_dev->name, 43, NFTOP_U_REDACT_SRC ? "REDACTED" : curr_dev->addresses->ip, tx_is, rx_is, sum_is);
+            displayWrite("%-16s %-*s %12s %12s %13s\n", name, 43, NFTOP_U_REDACT_SRC ? "REDACTED" : curr_dev->addresses->ip, tx_is, rx_is, sum_is);
         } else {
              if (NFTOP_U_CONTINUOUS || is_redirected()) {
-                displayWrite("%-16s %-*s %12s %12s %13s\n", curr_dev->name, 43, "0.0.0.0", tx_is, rx_is, sum_is);
+                displayWrite("%-16s %-*s %12s %12s %13s\n", name, 43, "0.0.0.0", tx_is, rx_is, sum_is);
             } else {
-                displayWrite("%-60s %12s %12s %13s\n", curr_dev->name, tx_is, rx_is, sum_is);
+                displayWrite("%-60s %12s %12s %13s\n", name, tx_is, rx_is, sum_is);
             }
 
             struct Address *addr = curr_dev->addresses;
             while (addr->ip != NULL) {
-                tx_as = formatUOM(addr->bps_tx);
-                rx_as = formatUOM(addr->bps_rx);
-                sum_as = formatUOM(addr->bps_sum);
+                formatUOM(addr->bps_tx, tx_as, sizeof(tx_as));
+                formatUOM(addr->bps_rx, rx_as, sizeof(rx_as));
+                formatUOM(addr->bps_sum, sum_as, sizeof(sum_as));
                 if (NFTOP_U_CONTINUOUS || is_redirected()) {
-                    displayWrite("%-16s %-43s %12s %12s %13s\n", curr_dev->name, NFTOP_U_REDACT_SRC ? "REDACTED" : addr->ip, tx_as, rx_as, sum_as);
+                    displayWrite("%-16s %-43s %12s %12s %13s\n", name, NFTOP_U_REDACT_SRC ? "REDACTED" : addr->ip, tx_as, rx_as, sum_as);
                 } else {
                     displayWrite("%16s %-43s %12s %12s %13s\n", pad, NFTOP_U_REDACT_SRC ? "REDACTED" : addr->ip, tx_as, rx_as, sum_as);
                 }
-                free(tx_as);
-                free(rx_as);
-                free(sum_as);
                 addr = addr->next;
             }
         }
+    }
+}
 
-        free(tx_is);
-        free(rx_is);
-        free(sum_is);
+/* formats the l4 ports of a tuple; ICMP flows show their ID and type/code instead */
+static void watch_ports(const struct Flow *flow, uint16_t sport, uint16_t dport, char *buf, size_t len) {
+    if (flow->proto_l4 == IPPROTO_ICMP || flow->proto_l4 == IPPROTO_ICMPV6)
+        snprintf(buf, len, "id %u type %u code %u", ntohs(flow->orig_sport), flow->orig_dport >> 8, flow->orig_dport & 0xff);
+    else
+        snprintf(buf, len, "%u -> %u", ntohs(sport), ntohs(dport));
+}
 
+/*
+ * watch mode (-W): the watched flow with its counters and current rates, and a graph of its total rate
+ * over the last polls (samples holds count polls, oldest first) as wide as the terminal allows
+ */
+void displayWatch(const struct Flow *flow, const struct WatchSample *samples, size_t count) {
+    char orig_src[INET6_ADDRSTRLEN], orig_dst[INET6_ADDRSTRLEN], repl_src[INET6_ADDRSTRLEN], repl_dst[INET6_ADDRSTRLEN];
+    char orig_ports[48], repl_ports[48], interval_str[16];
+    char proto_name[NFTOP_PROTO_LEN], orig_s[NFTOP_UOM_LEN], repl_s[NFTOP_UOM_LEN], sum_s[NFTOP_UOM_LEN],
+         max_s[NFTOP_UOM_LEN], avg_s[NFTOP_UOM_LEN];
+    int64_t value, max = 0, total = 0;
+    size_t i, first = 0, width;
+    int row;
+
+#ifdef ENABLE_NCURSES
+    int max_x, max_y;
+#else
+    short unsigned int max_y, max_x;
+    max_y = 0;
+    max_x = 0;
+#endif
+
+    getwinsize(w, &max_y, &max_x);
+    if (is_redirected() || max_x < 40)
+        max_x = 80;
+
+    // the graph is as wide as the terminal, right of a 12 character scale
+    width = max_x - 15;
+    if (count > width)
+        first = count - width;
+
+    for (i = first; i < count; i++) {
+        value = samples[i].bps_orig + samples[i].bps_repl;
+        if (value > max)
+            max = value;
+        total += value;
     }
-}
\ No newline at end of file
+
+    inet_ntop(flow->proto_l3, &flow->orig_src, orig_src, sizeof(orig_src));
+    inet_ntop(flow->proto_l3, &flow->orig_dst, orig_dst, sizeof(orig_dst));
+    inet_ntop(flow->proto_l3, &flow->repl_src, repl_src, sizeof(repl_src));
+    inet_ntop(flow->proto_l3, &flow->repl_dst, repl_dst, sizeof(repl_dst));
+    watch_ports(flow, flow->orig_sport, flow->orig_dport, orig_ports, sizeof(orig_ports));
+    watch_ports(flow, flow->repl_sport, flow->repl_dport, repl_ports, sizeof(repl_ports));
+
+    if (NFTOP_U_INTERVAL == (int)NFTOP_U_INTERVAL)
+        snprintf(interval_str, sizeof(interval_str), "%03d", (int)NFTOP_U_INTERVAL);
+    else
+        snprintf(interval_str, sizeof(interval_str), "%g", NFTOP_U_INTERVAL);
+
+    getIPProtocolName(flow->proto_l3, flow->proto_l4, proto_name, sizeof(proto_name));
+    formatUOM(count ? samples[count - 1].bps_orig : 0, orig_s, sizeof(orig_s));
+    formatUOM(count ? samples[count - 1].bps_repl : 0, repl_s, sizeof(repl_s));
+    formatUOM(count ? samples[count - 1].bps_orig + samples[count - 1].bps_repl : 0, sum_s, sizeof(sum_s));
+    formatUOM(max, max_s, sizeof(max_s));
+    formatUOM(count > first ? total / (int64_t)(count - first) : 0, avg_s, sizeof(avg_s));
+
+    if (!NFTOP_FLAGS_PAUSE)
+        displayClear();
+
+    displayWrite("[NFTOP] Watch: %u | %s | %ss | mark 0x%x | zone %u\n", flow->id,
+        NFTOP_FLAGS_PAUSE ? "PAUSED" : "RUNNING", interval_str, flow->mark, flow->zone);
+    displayWrite("\n");
+    displayWrite("  %-6s %s -> %s  %s\n", proto_name, orig_src, orig_dst, orig_ports);
+    displayWrite("  %-6s %s -> %s  %s\n", "reply", repl_src, repl_dst, repl_ports);
+    displayWrite("\n");
+    displayWrite("  %-8s %20lu %20lu\n", "bytes", flow->bytes_orig, flow->bytes_repl);
+    displayWrite("  %-8s %20s %20s %20s\n", "rate", orig_s, repl_s, sum_s);
+    displayWrite("  %-8s %20s %20s   (last %lu polls)\n", "max/avg", max_s, avg_s, count - first);
+    displayWrite("\n");
+
+    // a column per poll, filled up to its share of the window's highest rate
+    for (row = NFTOP_WATCH_ROWS; row > 0; row--) {
+        if (row == NFTOP_WATCH_ROWS)
+            displayWrite("%12s |", max_s);
+        else if (row == 1)
+            displayWrite("%12s |", "0");
+        else
+            displayWrite("%12s |", "");
+
+        for (i = first; i < count; i++) {
+            value = samples[i].bps_orig + samples[i].bps_repl;
+            displayWrite("%c", value > 0 && (row == 1 || value * NFTOP_WATCH_ROWS >= max * (row - 1) + max / 2) ? '#' : ' ');
+        }
+        displayWrite("\n");
+    }
+    displayWrite("%12s +", "");
+    for (i = first; i < count; i++)
+        displayWrite("-");
+    displayWrite("\n");
+}
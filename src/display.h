@@ -9,6 +9,8 @@
 #ifndef _NFTOP_DISP_H
 #define _NFTOP_DISP_H
 
+#define NFTOP_WATCH_ROWS 10    // height of the rate graph of watch mode (-W)
+
 #ifndef ENABLE_NCURSES
 #define gotoxy(x,y) printf("\033[%d;%dH", (y), (x))
 #endif
@@ -19,7 +21,9 @@ void displayClose();
 void displayHeader();
 void displayRefresh();
 void displayWrite(const char *fmt, ...);
-void displayCTInfo(struct Connection *);
+int displayRows(int);
+void displayCTInfo(const struct Connections *, uint32_t);
 void displayDevices(struct Interface *);
+void displayWatch(const struct Flow *, const struct WatchSample *, size_t);
 
 #endif
\ No newline at end of file
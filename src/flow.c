@@ -0,0 +1,283 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include <libmnl/libmnl.h>
+#include <libnetfilter_conntrack/libnetfilter_conntrack.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+#include "nftop.h"
+#include "flow.h"
+
+/* extract the fields nftop uses from a conntrack object into a compact flow record */
+void ct2flow(const struct nf_conntrack *ct, struct Flow *flow) {
+    memset(flow, 0, sizeof(struct Flow));
+
+    flow->id = nfct_get_attr_u32(ct, ATTR_ID);
+    flow->status = nfct_get_attr_u32(ct, ATTR_STATUS);
+    flow->mark = nfct_get_attr_u32(ct, ATTR_MARK);
+    flow->zone = nfct_get_attr_u16(ct, ATTR_ZONE);
+    flow->proto_l3 = nfct_get_attr_u8(ct, ATTR_L3PROTO);
+    flow->proto_l4 = nfct_get_attr_u8(ct, ATTR_L4PROTO);
+
+    switch(flow->proto_l4) {
+        case IPPROTO_TCP:
+            flow->status_l4 = nfct_get_attr_u8(ct, ATTR_TCP_STATE);
+            break;
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            flow->orig_sport = nfct_get_attr_u16(ct, ATTR_ICMP_ID);
+            flow->orig_dport = (nfct_get_attr_u8(ct, ATTR_ICMP_TYPE) << 8) | nfct_get_attr_u8(ct, ATTR_ICMP_CODE);
+            break;
+    }
+
+    if (flow->proto_l4 != IPPROTO_ICMP && flow->proto_l4 != IPPROTO_ICMPV6) {
+        flow->orig_sport = nfct_get_attr_u16(ct, ATTR_ORIG_PORT_SRC);
+        flow->orig_dport = nfct_get_attr_u16(ct, ATTR_ORIG_PORT_DST);
+        flow->repl_sport = nfct_get_attr_u16(ct, ATTR_REPL_PORT_SRC);
+        flow->repl_dport = nfct_get_attr_u16(ct, ATTR_REPL_PORT_DST);
+    }
+
+    flow->time_start = nfct_get_attr_u64(ct, ATTR_TIMESTAMP_START);
+    flow->time_stop = nfct_get_attr_u64(ct, ATTR_TIMESTAMP_STOP);
+    flow->bytes_orig = nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_BYTES);
+    flow->bytes_repl = nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_BYTES);
+
+    if (flow->proto_l3 == AF_INET) {
+        memcpy(&flow->orig_src, nfct_get_attr(ct, ATTR_ORIG_IPV4_SRC), sizeof(struct in_addr));
+        memcpy(&flow->orig_dst, nfct_get_attr(ct, ATTR_ORIG_IPV4_DST), sizeof(struct in_addr));
+        memcpy(&flow->repl_src, nfct_get_attr(ct, ATTR_REPL_IPV4_SRC), sizeof(struct in_addr));
+        memcpy(&flow->repl_dst, nfct_get_attr(ct, ATTR_REPL_IPV4_DST), sizeof(struct in_addr));
+    } else if (flow->proto_l3 == AF_INET6) {
+        memcpy(&flow->orig_src, nfct_get_attr(ct, ATTR_ORIG_IPV6_SRC), sizeof(struct in6_addr));
+        memcpy(&flow->orig_dst, nfct_get_attr(ct, ATTR_ORIG_IPV6_DST), sizeof(struct in6_addr));
+        memcpy(&flow->repl_src, nfct_get_attr(ct, ATTR_REPL_IPV6_SRC), sizeof(struct in6_addr));
+        memcpy(&flow->repl_dst, nfct_get_attr(ct, ATTR_REPL_IPV6_DST), sizeof(struct in6_addr));
+    }
+}
+
+/* nested attributes are only trusted if their payload is large enough for the type read */
+#define ATTR_FITS(attr, type) (mnl_attr_get_payload_len(attr) >= sizeof(type))
+
+static int parse_counters(const struct nlattr *nest, uint64_t *bytes) {
+    const struct nlattr *attr;
+
+    mnl_attr_for_each_nested(attr, nest) {
+        switch (mnl_attr_get_type(attr)) {
+            case CTA_COUNTERS_BYTES:
+                if (!ATTR_FITS(attr, uint64_t))
+                    return -1;
+                *bytes = be64toh(mnl_attr_get_u64(attr));
+                break;
+            case CTA_COUNTERS32_BYTES:
+                if (!ATTR_FITS(attr, uint32_t))
+                    return -1;
+                *bytes = ntohl(mnl_attr_get_u32(attr));
+                break;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_timestamp(const struct nlattr *nest, struct Flow *flow) {
+    const struct nlattr *attr;
+
+    mnl_attr_for_each_nested(attr, nest) {
+        switch (mnl_attr_get_type(attr)) {
+            case CTA_TIMESTAMP_START:
+                if (!ATTR_FITS(attr, uint64_t))
+                    return -1;
+                flow->time_start = be64toh(mnl_attr_get_u64(attr));
+                break;
+            case CTA_TIMESTAMP_STOP:
+                if (!ATTR_FITS(attr, uint64_t))
+                    return -1;
+                flow->time_stop = be64toh(mnl_attr_get_u64(attr));
+                break;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_protoinfo(const struct nlattr *nest, struct Flow *flow) {
+    const struct nlattr *attr, *tcp;
+
+    mnl_attr_for_each_nested(attr, nest) {
+        if (mnl_attr_get_type(attr) != CTA_PROTOINFO_TCP)
+            continue;
+
+        mnl_attr_for_each_nested(tcp, attr) {
+            if (mnl_attr_get_type(tcp) == CTA_PROTOINFO_TCP_STATE) {
+                if (!ATTR_FITS(tcp, uint8_t))
+                    return -1;
+                flow->status_l4 = mnl_attr_get_u8(tcp);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int parse_tuple(const struct nlattr *nest, struct Flow *flow, int orig) {
+    const struct nlattr *attr, *inner;
+    struct in6_addr *src = orig ? &flow->orig_src : &flow->repl_src;
+    struct in6_addr *dst = orig ? &flow->orig_dst : &flow->repl_dst;
+    uint16_t *sport = orig ? &flow->orig_sport : &flow->repl_sport;
+    uint16_t *dport = orig ? &flow->orig_dport : &flow->repl_dport;
+
+    mnl_attr_for_each_nested(attr, nest) {
+        switch (mnl_attr_get_type(attr)) {
+            case CTA_TUPLE_IP:
+                mnl_attr_for_each_nested(inner, attr) {
+                    switch (mnl_attr_get_type(inner)) {
+                        case CTA_IP_V4_SRC:
+                        case CTA_IP_V4_DST:
+                            if (!ATTR_FITS(inner, struct in_addr))
+                                return -1;
+                            memcpy(mnl_attr_get_type(inner) == CTA_IP_V4_SRC ? src : dst, mnl_attr_get_payload(inner), sizeof(struct in_addr));
+                            break;
+                        case CTA_IP_V6_SRC:
+                        case CTA_IP_V6_DST:
+                            if (!ATTR_FITS(inner, struct in6_addr))
+                                return -1;
+                            memcpy(mnl_attr_get_type(inner) == CTA_IP_V6_SRC ? src : dst, mnl_attr_get_payload(inner), sizeof(struct in6_addr));
+                            break;
+                    }
+                }
+                break;
+            case CTA_TUPLE_PROTO:
+                mnl_attr_for_each_nested(inner, attr) {
+                    switch (mnl_attr_get_type(inner)) {
+                        case CTA_PROTO_NUM:
+                            if (!ATTR_FITS(inner, uint8_t))
+                                return -1;
+                            if (orig)
+                                flow->proto_l4 = mnl_attr_get_u8(inner);
+                            break;
+                        case CTA_PROTO_SRC_PORT:
+                            if (!ATTR_FITS(inner, uint16_t))
+                                return -1;
+                            *sport = mnl_attr_get_u16(inner);
+                            break;
+                        case CTA_PROTO_DST_PORT:
+                            if (!ATTR_FITS(inner, uint16_t))
+                                return -1;
+                            *dport = mnl_attr_get_u16(inner);
+                            break;
+                        // ICMP identifies flows by id and type/code, kept in the orig "ports" (see struct Flow)
+                        case CTA_PROTO_ICMP_ID:
+                        case CTA_PROTO_ICMPV6_ID:
+                            if (!ATTR_FITS(inner, uint16_t))
+                                return -1;
+                            if (orig)
+                                flow->orig_sport = mnl_attr_get_u16(inner);
+                            break;
+                        case CTA_PROTO_ICMP_TYPE:
+                        case CTA_PROTO_ICMPV6_TYPE:
+                            if (!ATTR_FITS(inner, uint8_t))
+                                return -1;
+                            if (orig)
+                                flow->orig_dport = (flow->orig_dport & 0x00ff) | (mnl_attr_get_u8(inner) << 8);
+                            break;
+                        case CTA_PROTO_ICMP_CODE:
+                        case CTA_PROTO_ICMPV6_CODE:
+                            if (!ATTR_FITS(inner, uint8_t))
+                                return -1;
+                            if (orig)
+                                flow->orig_dport = (flow->orig_dport & 0xff00) | mnl_attr_get_u8(inner);
+                            break;
+                    }
+                }
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * single pass over the CTA_* attributes of a ctnetlink message into a flow record; this is the hot path
+ * of a dump, the result is identical to nfct_nlmsg_parse() followed by ct2flow().
+ * returns -1 if the message is not a conntrack entry or is malformed.
+ */
+int nlmsg2flow(const struct nlmsghdr *nlh, struct Flow *flow) {
+    const struct nfgenmsg *nfh;
+    const struct nlattr *attr;
+    int has_tuple = 0;
+
+    if ((nlh->nlmsg_type >> 8) != NFNL_SUBSYS_CTNETLINK)
+        return -1;
+    if ((nlh->nlmsg_type & 0xff) != IPCTNL_MSG_CT_NEW && (nlh->nlmsg_type & 0xff) != IPCTNL_MSG_CT_DELETE)
+        return -1;
+    if (mnl_nlmsg_get_payload_len(nlh) < sizeof(struct nfgenmsg))
+        return -1;
+
+    memset(flow, 0, sizeof(struct Flow));
+
+    nfh = mnl_nlmsg_get_payload(nlh);
+    flow->proto_l3 = nfh->nfgen_family;
+
+    mnl_attr_for_each(attr, nlh, sizeof(struct nfgenmsg)) {
+        switch (mnl_attr_get_type(attr)) {
+            case CTA_TUPLE_ORIG:
+                if (parse_tuple(attr, flow, 1) == -1)
+                    return -1;
+                has_tuple = 1;
+                break;
+            case CTA_TUPLE_REPLY:
+                if (parse_tuple(attr, flow, 0) == -1)
+                    return -1;
+                break;
+            case CTA_STATUS:
+                if (!ATTR_FITS(attr, uint32_t))
+                    return -1;
+                flow->status = ntohl(mnl_attr_get_u32(attr));
+                break;
+            case CTA_MARK:
+                if (!ATTR_FITS(attr, uint32_t))
+                    return -1;
+                flow->mark = ntohl(mnl_attr_get_u32(attr));
+                break;
+            case CTA_ID:
+                if (!ATTR_FITS(attr, uint32_t))
+                    return -1;
+                flow->id = ntohl(mnl_attr_get_u32(attr));
+                break;
+            case CTA_ZONE:
+                if (!ATTR_FITS(attr, uint16_t))
+                    return -1;
+                flow->zone = ntohs(mnl_attr_get_u16(attr));
+                break;
+            case CTA_PROTOINFO:
+                if (parse_protoinfo(attr, flow) == -1)
+                    return -1;
+                break;
+            case CTA_COUNTERS_ORIG:
+                if (parse_counters(attr, &flow->bytes_orig) == -1)
+                    return -1;
+                break;
+            case CTA_COUNTERS_REPLY:
+                if (parse_counters(attr, &flow->bytes_repl) == -1)
+                    return -1;
+                break;
+            case CTA_TIMESTAMP:
+                if (parse_timestamp(attr, flow) == -1)
+                    return -1;
+                break;
+        }
+    }
+
+    return has_tuple ? 0 : -1;
+}
@@ -0,0 +1,15 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_FLOW_H
+#define _NFTOP_FLOW_H
+
+void ct2flow(const struct nf_conntrack *, struct Flow *);
+int nlmsg2flow(const struct nlmsghdr *, struct Flow *);
+
+#endif
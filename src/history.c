@@ -0,0 +1,73 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmnl/libmnl.h>
+
+#include "nftop.h"
+#include "history.h"
+
+static inline size_t history_hash(uint32_t id, time_t time_start) {
+    uint64_t h = (uint64_t)id * 0x9e3779b97f4a7c15ULL ^ (uint64_t)time_start * 0xc2b2ae3d27d4eb4fULL;
+
+    return h ^ (h >> 32);
+}
+
+/*
+ * indexes the connections of conns by (id, time_start); the slots are reused across generations.
+ * Linear probing keeps a key's entries in index order, so a lookup finds the first one, as a walk
+ * of the columns would. NULL indexes no connection.
+ */
+void historyIndex(struct HistoryIndex *index, const struct Connections *conns) {
+    size_t count = conns != NULL ? conns->count : 0, size = NFTOP_HISTORY_MIN_SLOTS, i, ct;
+
+    while (size < count * 2)
+        size <<= 1;
+
+    if (size != index->size) {
+        free(index->slots);
+        if (!(index->slots = malloc(size * sizeof(struct HistorySlot)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        index->size = size;
+    }
+    memset(index->slots, 0, size * sizeof(struct HistorySlot));
+    index->count = count;
+
+    for (ct = 0; ct < count; ct++) {
+        for (i = history_hash(conns->id[ct], conns->time_start[ct]) & (size - 1); index->slots[i].conn != 0; i = (i + 1) & (size - 1))
+            ;
+        index->slots[i].id = conns->id[ct];
+        index->slots[i].time_start = conns->time_start[ct];
+        index->slots[i].conn = ct + 1;
+    }
+}
+
+/* the index of the previous observation of a connection, -1 if there is none (the start time guards against ID reuse) */
+ssize_t historyLookup(const struct HistoryIndex *index, uint32_t id, time_t time_start) {
+    size_t i;
+
+    if (index->count == 0)
+        return -1;
+
+    for (i = history_hash(id, time_start) & (index->size - 1); index->slots[i].conn != 0; i = (i + 1) & (index->size - 1)) {
+        if (index->slots[i].id == id && index->slots[i].time_start == time_start)
+            return index->slots[i].conn - 1;
+    }
+
+    return -1;
+}
+
+void historyFree(struct HistoryIndex *index) {
+    free(index->slots);
+    memset(index, 0, sizeof(*index));
+}
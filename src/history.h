@@ -0,0 +1,31 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_HISTORY_H
+#define _NFTOP_HISTORY_H
+
+#define NFTOP_HISTORY_MIN_SLOTS 1024    // smallest index; it is sized to at most half full
+
+struct HistorySlot {
+    uint32_t id;
+    uint32_t conn;              // 1 + the index of the connection, 0 for an empty slot
+    time_t time_start;
+};
+
+/* open-addressing index of the previous generation, keyed by conntrack ID and start time */
+struct HistoryIndex {
+    struct HistorySlot *slots;
+    size_t size;                // a power of 2
+    size_t count;
+};
+
+void historyIndex(struct HistoryIndex *, const struct Connections *);
+ssize_t historyLookup(const struct HistoryIndex *, uint32_t, time_t);
+void historyFree(struct HistoryIndex *);
+
+#endif
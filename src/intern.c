@@ -0,0 +1,107 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "intern.h"
+
+/*
+ * The host, service and interface names of the connections, each stored once for the life of the
+ * process. A name's handle is its offset in the pool of strings, so that internedString() is an
+ * addition; handle 0 is the empty string. The pool moves when it grows: the pointers returned by
+ * internedString() are only good until the next internString().
+ */
+
+static char *pool = NULL;
+static size_t pool_used = 0;
+static size_t pool_size = 0;
+static uint32_t *slots = NULL;      // handles of the names by hash, 0 for an empty slot
+static size_t slots_size = 0;       // a power of 2
+static size_t slots_used = 0;
+
+static uint32_t intern_hash(const char *s) {
+    uint32_t hash = 2166136261u;
+
+    while (*s)
+        hash = (hash ^ (uint8_t)*s++) * 16777619u;
+
+    return hash;
+}
+
+static void intern_grow_slots() {
+    uint32_t *old = slots;
+    size_t old_size = slots_size, i, j;
+
+    slots_size = slots_size ? slots_size * 2 : NFTOP_INTERN_MIN_SLOTS;
+    if (!(slots = calloc(slots_size, sizeof(uint32_t)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < old_size; i++) {
+        if (old[i] == 0)
+            continue;
+        for (j = intern_hash(pool + old[i]) & (slots_size - 1); slots[j] != 0; j = (j + 1) & (slots_size - 1))
+            ;
+        slots[j] = old[i];
+    }
+
+    free(old);
+}
+
+/* the handle of s, adding it to the table if it isn't in it */
+uint32_t internString(const char *s) {
+    size_t len, i;
+
+    if (*s == '\0')
+        return 0;
+
+    if (slots_used * 2 >= slots_size)
+        intern_grow_slots();
+
+    for (i = intern_hash(s) & (slots_size - 1); slots[i] != 0; i = (i + 1) & (slots_size - 1)) {
+        if (strcmp(pool + slots[i], s) == 0)
+            return slots[i];
+    }
+
+    // the first byte of the pool is the empty string of handle 0
+    len = strlen(s) + 1;
+    if (pool_used + len > pool_size) {
+        pool_size = pool_size ? pool_size : NFTOP_INTERN_MIN_POOL;
+        while (pool_used + len + 1 > pool_size)
+            pool_size *= 2;
+        if (!(pool = realloc(pool, pool_size))) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        if (pool_used == 0)
+            pool[pool_used++] = '\0';
+    }
+
+    memcpy(pool + pool_used, s, len);
+    slots[i] = pool_used;
+    slots_used++;
+    pool_used += len;
+
+    return slots[i];
+}
+
+const char *internedString(uint32_t handle) {
+    return handle ? pool + handle : "";
+}
+
+void internFree() {
+    free(pool);
+    free(slots);
+    pool = NULL;
+    slots = NULL;
+    pool_used = pool_size = slots_size = slots_used = 0;
+}
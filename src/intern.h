@@ -0,0 +1,19 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_INTERN_H
+#define _NFTOP_INTERN_H
+
+#define NFTOP_INTERN_MIN_SLOTS  256     // smallest index; it is sized to at most half full
+#define NFTOP_INTERN_MIN_POOL   4096    // bytes of strings the pool starts with
+
+uint32_t internString(const char *);
+const char *internedString(uint32_t);
+void internFree();
+
+#endif
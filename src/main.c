@@ -9,6 +9,7 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <time.h>
 #include <errno.h>
 #include <ctype.h>  /* isalpha/isprint */
@@ -22,13 +23,29 @@
 #include "nftop.h"
 #include "display.h"
 #include "util.h"
+#include "conntrack.h"
+#include "netns.h"
+#include "history.h"
+#include "arena.h"
+#include "rates.h"
+#include "alloc.h"
+#include "intern.h"
 
 #define USAGE_STRING "nftop: Display connection information from netfilter conntrack entries (including at-the-time throughput values for transmit, receive and sum)\n\n\
 Usage:\n\
-nftop [-46dbnNPrRS] [-a \033[4mage_format\033[0m] [-i in interface] [-o out interface] [-s sort column] [-t threshold] [-u update interval]  [-w]\n\
+nftop [-46dbCenNPrRSZ] [-a \033[4mage_format\033[0m] [-E intervals] [-f file] [-H shard mask] [-i in interface] [-U cpu budget] [-W id|tuple] [-k mark[/mask]] [-K rcvbuf] [-o out interface] [-X netns] [-s sort column] [-t threshold] [-u update interval] [-w] [-z zone]\n\
   -4                    output only IPv4 connections\n\
   -6                    output only IPv6 connections\n\
   -d|--dev              output device table instead of connections\n\
+  -e|--events           track connections via conntrack events instead of a full table dump every interval\n\
+  -E|--resync  \033[4mintervals\033[0m	in event mode, re-synchronize the table with a full dump every N intervals\n\
+  -C|--closed           account the final counters of connections closed between updates (DESTROY events)\n\
+  -Z|--zero             zero the conntrack counters with every dump and compute rates without the previous dump\n\
+  -U|--cpu-budget  \033[4mpercent\033[0m	adapt the update interval (and skip DNS lookups) to use at most percent of a CPU\n\
+  -f|--file  \033[4mpath\033[0m	read the table from a file in /proc/net/nf_conntrack format instead of ctnetlink\n\
+  -W|--watch  \033[4mid|tuple\033[0m	poll a single connection (ID, or proto,src,sport,dst,dport) and graph its rate\n\
+  -H|--shards  \033[4mmask\033[0m	dump one shard (the mark bits under mask) of the table per update, i.e. 0xf: 16 shards\n\
+  -F|--nfct-parse       parse dumps with libnetfilter_conntrack instead of the built-in attribute parser\n\
   -b|--bytes		output bytes insted of default bits\n\
   -B|--bps          output the connection/interface only in bits-per-second, without scaling to Kbps, Mpbs, etc.\n\
   -I|--id               output connection tracking ID\n\
@@ -42,20 +59,25 @@ nftop [-46dbnNPrRS] [-a \033[4mage_format\033[0m] [-i in interface] [-o out inte
   -a|--age  \033[4m0-2\033[0m		format of age column 0: do not display, 1: seconds, 2: DD HH MM SS format (default is do not display)\n\
                         (only availble if \"net.netfilter.nf_conntrack_timestamp\" kernel option is enabled)\n\
   -t|--threshold  \033[4mbits\033[0m	minimum SUM value to display (in bits)\n\
-  -u|--update  \033[4mseconds\033[0m	update interval in seconds\n\
+  -u|--update  \033[4mseconds\033[0m	update interval in seconds (fractions such as 0.25 are accepted)\n\
   -i|--in    \033[4minterface\033[0m	interface name to filter as input interface\n\
+  -k|--mark  \033[4mvalue[/mask]\033[0m	only output connections whose mark (CONNMARK) matches value under mask\n\
+  -z|--zone  \033[4mzone\033[0m	only output connections in the given conntrack zone\n\
+  -X|--netns  \033[4mname|path\033[0m	collect from a network namespace (/var/run/netns/name or a path); repeat for several\n\
+  -K|--rcvbuf  \033[4mbytes\033[0m	netlink socket receive buffer (grown automatically when a dump overruns)\n\
   -o|--out   \033[4minterface\033[0m	interface name to filter as output interface\n\
   -s|--sort  \033[4m[+]column\033[0m	column to sort by -- one of [id, in, out, sport, dport, rx, tx, sum]\n\
                         the default is \033[1mDESCENDING\033[0m order; use +\033[4mcolumn\033[0m to sort in \033[1mASCENDING\033[0m order\n\
   -v|--version          version\n\
   -V|--verbose          Enable the TCP state field\n\
   -w|--wide             output report in wide format (single row for both SRC and DST)\n\
-\n\
-Examples:\n\
+\n"
+#define USAGE_EXAMPLES_STRING "Examples:\n\
   nftop -o wwan0	only output connections that egress out interface \"wwan0\"\n\
   nftop -t 1000000	only output connections that are at least 1Mbps (sum)\n\
   nftop -i vlan+	only output connections that match ingress interface \"vlan*\"\n\
   nftop -s +id		sort output by \033[1mID\033[0m column in \033[1mASCENDING\033[0m order\n\
+  nftop -k 0x100/0xff00	only output connections marked 0x1XX (policy routing table 1)\n\
 \n\
 Notes:\n\
   The assotiation of the in/out interface/device is derived via comparison of the connection local source/destination address against the assigned\n\
@@ -67,7 +89,7 @@ Requirements:\n\
   root or cap_net_admin+eip permissions\n"
 
 // User option defaults
-int     NFTOP_U_INTERVAL 		= 2;				// time between updates in seconds
+double  NFTOP_U_INTERVAL 		= 2;				// time between updates in seconds (fractional down to NFTOP_MIN_INTERVAL)
 int     NFTOP_U_DISPLAY_AGE 	= 0; 				// 0 = no display, 1 = numeric (seconds), 2 = string (i.e.: 1d 14h 18m 24s)
 int     NFTOP_U_DISPLAY_STATUS  = 0;                // enable display of the status field (CONFIRMED, ASSURED, CLOSING, etc.)
 int     NFTOP_U_SI 		    	= 1;				// use Standards International format (default: true)
@@ -93,6 +115,20 @@ int     NFTOP_U_NUMERIC_PORT    = 0;                // numeric/non-dns display o
 int     NFTOP_U_BPS             = 0;                // use bps only (no scaling of units)
 int     NFTOP_U_CONTINUOUS      = 0;                // output continously without displaying header or screen reset
 int     NFTOP_U_MACHINE         = 0;                // enables -c, -B and -w
+int     NFTOP_U_EVENTS          = 0;                // maintain the connection table from conntrack events
+int     NFTOP_U_EVENT_RESYNC    = 30;               // intervals between full dumps in event mode
+int     NFTOP_U_NFCT_PARSE      = 0;                // parse dumps with libnetfilter_conntrack instead of the libmnl fast path
+uint32_t NFTOP_U_MARK           = 0;                // connection mark filter value
+uint32_t NFTOP_U_MARK_MASK      = 0;                // connection mark filter mask (0 = no mark filter)
+int     NFTOP_U_ZONE            = -1;               // conntrack zone filter (-1 = no zone filter)
+int     NFTOP_U_RCVBUF          = 0;                // netlink socket receive buffer in bytes (0 = kernel default)
+int     NFTOP_U_ZERO            = 0;                // zero the conntrack counters with every dump (no history join)
+int     NFTOP_U_CLOSED          = 0;                // account the final counters of flows destroyed between dumps
+int     NFTOP_U_NETNS_VIEW      = -1;               // namespace shown when collecting from several (-1 = all, merged)
+uint32_t NFTOP_U_SHARD_MASK     = 0;                // mark bits splitting the table into shards dumped in turn (0 = full dumps)
+double  NFTOP_U_CPU_BUDGET      = 0;                // percent of a CPU the update cycle may use (0 = fixed interval)
+char*   NFTOP_U_WATCH           = NULL;             // connection (ID or tuple) polled by watch mode
+char*   NFTOP_U_PROC_FILE       = NULL;             // table read from a file in /proc/net/nf_conntrack format instead of ctnetlink
 
 // Runtime flags
 int		NFTOP_FLAGS_TIMESTAMP	= 1;				// flag for conntrack_timestamp detection
@@ -100,6 +136,7 @@ int     NFTOP_FLAGS_EXIT        = 0;                // stop application, cleanup
 int     NFTOP_FLAGS_PAUSE       = 0;                // display is paused
 int     NFTOP_FLAGS_DEV_ONLY    = 0;                // display device list only (with bandwidth reporting)
 int     NFTOP_FLAGS_DEBUG       = 0;                // output debug information to stderr
+int     NFTOP_FLAGS_SKIP_DNS    = 0;                // host name lookups suspended to stay within the CPU budget
 
 // global size values
 int     NFTOP_DISPLAY_COUNT     = 1024;             // maximum lines of connections to display
@@ -108,12 +145,24 @@ int     NFTOP_DISPLAY_COUNT     = 1024;             // maximum lines of connecti
 uint64_t NFTOP_TX_ALL = 0;
 uint64_t NFTOP_RX_ALL = 0;
 int NFTOP_CT_COUNT = 0;
+uint64_t NFTOP_DUMP_SYSCALLS = 0;   // send/recv calls of the last dump
+uint64_t NFTOP_DUMP_BYTES = 0;      // bytes received by the last dump
+int NFTOP_DUMP_RETRIES = 0;         // dumps restarted after an overrun (ENOBUFS) during the last query
+uint64_t NFTOP_DUMP_ELAPSED = 0;    // nanoseconds (CLOCK_MONOTONIC) between the last two dumps
+struct ConntrackStats NFTOP_CT_STATS;  // table size and pressure counters, refreshed every interval
+int NFTOP_DUMP_PARTIAL = 0;         // the last query gave up on an overrunning dump and kept a partial table
+int NFTOP_DUMP_SHARD = 0;           // shard refreshed by the last query (-H)
+int NFTOP_DUMP_SHARDS = 1;          // shards the table is split into
+double NFTOP_INTERVAL = 2;          // effective update interval; NFTOP_U_INTERVAL unless stretched by the CPU budget
+uint64_t NFTOP_CYCLE_CPU = 0;       // CPU nanoseconds (all threads) used by the last update cycle
+double NFTOP_CYCLE_LOAD = 0;        // the same, in percent of the cycle's wall time
 int NFTOP_CT_ITER = 0;
 int NFTOP_DNS_ITER = 0;
 size_t NFTOP_MAX_HOSTNAME = 42;
 int NFTOP_MAX_SERVICE = 7;
 struct DNSCache *dns_cache;
 struct DNSCache *dns_cache_head;
+const struct Connections *compare_conns;    // the connections whose indexes compare_connections() sorts
 
 struct sigaction action;
 
@@ -130,174 +179,10 @@ void term(int signum) {
     NFTOP_FLAGS_EXIT = 1;
 }
 
-static int data_cb(enum nf_conntrack_msg_type type,
-                   struct nf_conntrack *ct,
-                   void *data)
-{
-    struct Connection **curr_ct = (struct Connection **) data;
-    struct Connection *new_ct = NULL;
-
-    type = type; // get compiler to ignore that we don't use this param
-
-    if (ct == NULL || data == NULL)
-        return MNL_CB_OK;
-
-    NFTOP_CT_COUNT++;
-
-    uint8_t l3proto = nfct_get_attr_u8(ct, ATTR_L3PROTO);
-    uint8_t l4proto = nfct_get_attr_u8(ct, ATTR_L4PROTO);
-
-    if (l3proto != AF_INET && l3proto != AF_INET6)
-        return MNL_CB_OK;
-
-    if (!(*curr_ct)) {
-        new_ct = *curr_ct;
-    } else {
-        // allocate a new ct to add to the list
-        if (!(new_ct = malloc(sizeof(struct Connection)))) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
-        memset(new_ct, 0, sizeof(struct Connection));
-    }
-
-    switch(l4proto) {
-        case IPPROTO_TCP:
-            new_ct->status_l4 = nfct_get_attr_u8(ct, ATTR_TCP_STATE);
-            break;
-        case IPPROTO_UDP:
-        case IPPROTO_ICMP:
-        case IPPROTO_ICMPV6:
-        case IPPROTO_IGMP:
-        case IPPROTO_IPV6:
-        case 89:    // OSPF
-        case 112:   // VRRP
-            break;
-        default:
-            DLOG(NFTOP_FLAGS_DEBUG, "unknown l4proto (%d); discarding.\n", l4proto);
-            return MNL_CB_OK;
-    }
-
-    new_ct->id = nfct_get_attr_u32(ct, ATTR_ID);
-    time_t start = nfct_get_attr_u64(ct, ATTR_TIMESTAMP_START);
-    time_t stop = nfct_get_attr_u64(ct, ATTR_TIMESTAMP_STOP);
-
-    time_t delta_time;
-
-    if (stop == 0) {
-        time(&stop);
-    }
-
-    if (!start) {
-        delta_time = NFTOP_U_INTERVAL;
-        NFTOP_FLAGS_TIMESTAMP = 0;
-        NFTOP_U_DISPLAY_AGE = 0;
-    } else {
-        delta_time = stop - (time_t)(start / NSEC_PER_SEC);
-    }
-
-    new_ct->delta = delta_time;
-    new_ct->time_start = start;
-
-    new_ct->bytes_orig = nfct_get_attr_u64(ct, ATTR_ORIG_COUNTER_BYTES);
-    if (!new_ct->bytes_orig) {
-        new_ct->bytes_orig = 0;
-    }
-
-    new_ct->bytes_repl = nfct_get_attr_u64(ct, ATTR_REPL_COUNTER_BYTES);
-    if (!new_ct->bytes_repl) {
-        new_ct->bytes_repl = 0;
-    }
-
-    new_ct->bytes_sum = new_ct->bytes_orig + new_ct->bytes_repl;
-
-    new_ct->proto_l3 = nfct_get_attr_u8(ct, ATTR_L3PROTO);
-    new_ct->proto_l4 = nfct_get_attr_u8(ct, ATTR_L4PROTO);
-
-    new_ct->mark = nfct_get_attr_u32(ct, ATTR_MARK);
-
-    // TODO: probably better to use nfct_get_attr_grp and acquire ATTR_{ORIG,REPL}_{SRC,DST} to be protocol agnostic and less verbose
-    if (new_ct->proto_l3 == AF_INET) {
-        memcpy(&new_ct->local.src_ip, nfct_get_attr(ct, ATTR_ORIG_IPV4_SRC), sizeof(struct sockaddr_storage));
-        memcpy(&new_ct->local.dst_ip, nfct_get_attr(ct, ATTR_ORIG_IPV4_DST), sizeof(struct sockaddr_storage));
-        memcpy(&new_ct->remote.src_ip, nfct_get_attr(ct, ATTR_REPL_IPV4_SRC), sizeof(struct sockaddr_storage));
-        memcpy(&new_ct->remote.src_ip, nfct_get_attr(ct, ATTR_REPL_IPV4_DST), sizeof(struct sockaddr_storage));
-        inet_ntop(AF_INET, nfct_get_attr(ct, ATTR_ORIG_IPV4_SRC), new_ct->local.src, sizeof(new_ct->local.src));
-        inet_ntop(AF_INET, nfct_get_attr(ct, ATTR_ORIG_IPV4_DST), new_ct->local.dst, sizeof(new_ct->local.dst));
-        inet_ntop(AF_INET, nfct_get_attr(ct, ATTR_REPL_IPV4_SRC), new_ct->remote.src, sizeof(new_ct->remote.src));
-        inet_ntop(AF_INET, nfct_get_attr(ct, ATTR_REPL_IPV4_DST), new_ct->remote.dst, sizeof(new_ct->remote.dst));
-    } else if (new_ct->proto_l3 == AF_INET6) {
-        memcpy(&new_ct->local.src_ip, nfct_get_attr(ct, ATTR_ORIG_IPV6_SRC), sizeof(struct sockaddr_storage));
-        memcpy(&new_ct->local.dst_ip, nfct_get_attr(ct, ATTR_ORIG_IPV6_DST), sizeof(struct sockaddr_storage));
-        memcpy(&new_ct->remote.src_ip, nfct_get_attr(ct, ATTR_REPL_IPV6_SRC), sizeof(struct sockaddr_storage));
-        memcpy(&new_ct->remote.src_ip, nfct_get_attr(ct, ATTR_REPL_IPV6_DST), sizeof(struct sockaddr_storage));
-        inet_ntop(AF_INET6, nfct_get_attr(ct, ATTR_ORIG_IPV6_SRC), new_ct->local.src, sizeof(new_ct->local.src));
-        inet_ntop(AF_INET6, nfct_get_attr(ct, ATTR_ORIG_IPV6_DST), new_ct->local.dst, sizeof(new_ct->local.dst));
-        inet_ntop(AF_INET6, nfct_get_attr(ct, ATTR_REPL_IPV6_SRC), new_ct->remote.src, sizeof(new_ct->remote.src));
-        inet_ntop(AF_INET6, nfct_get_attr(ct, ATTR_REPL_IPV6_DST), new_ct->remote.dst, sizeof(new_ct->remote.dst));
-    }
-
-    new_ct->local.sport = ntohl(nfct_get_attr_u32(ct, ATTR_REPL_PORT_SRC));
-    new_ct->local.dport = ntohl(nfct_get_attr_u32(ct, ATTR_ORIG_PORT_SRC));
-
-    if (NFTOP_U_DNS && !NFTOP_U_NUMERIC_PORT) {
-        struct servent *service;
-        char *proto4 = getIPProtocolName(new_ct->proto_l3, new_ct->proto_l4);
-        proto4[3] = '\0'; // truncate any protocol version; i.e. "udp6"->"udp"
-        service = getservbyport(htons(new_ct->local.sport), proto4);
-        if (service != NULL) {
-            snprintf(new_ct->local.sport_str, NFTOP_MAX_SERVICE, "%s", service->s_name);
-        }
-
-        service = getservbyport(htons(new_ct->local.dport), proto4);
-        if (service != NULL) {
-            snprintf(new_ct->local.dport_str, NFTOP_MAX_SERVICE, "%s", service->s_name);
-        }
-        free(proto4);
-    }
-
-    new_ct->status = nfct_get_attr_u32(ct, ATTR_STATUS);
-
-    new_ct->is_dst_nat = (new_ct->status & IPS_DST_NAT) == IPS_DST_NAT;
-    new_ct->is_src_nat = (new_ct->status & IPS_SRC_NAT) == IPS_SRC_NAT;
-
-    (*curr_ct)->next = new_ct;
-    new_ct->next = NULL;
-    *curr_ct = new_ct;
-
-    return MNL_CB_OK;
-}
-
-/* sends a DUMP query to NFCT and registers a callback to process the entries */
-int queryNFCT(struct Connection* curr_ct) {
-    int ret;
-    uint32_t family = AF_UNSPEC;
-    struct nfct_handle *nfcthandle;
-
-    nfcthandle = nfct_open(CONNTRACK, 0);
-    if (!nfcthandle) {
-        perror("nfct_open");
-        return -1;
-    }
-
-    nfct_callback_unregister(nfcthandle);
-    nfct_callback_register(nfcthandle, NFCT_T_ALL, data_cb, &curr_ct);
-    ret = nfct_query(nfcthandle, NFCT_Q_DUMP, &family);
-
-    if (ret == -1) {
-        displayClose();
-        fprintf(stderr, "error: (%d)(%s)\n", ret, strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-
-    nfct_callback_unregister(nfcthandle);
-    nfct_close(nfcthandle);
-
-    return ret;
-}
-
 void sortAddresses(struct Address **head) {
-    // Convert linked list to array
+    // Convert linked list to array, kept for the next sort
+    static struct Address **addressArray = NULL;
+    static int addressArraySize = 0;
     int count = 0;
     struct Address *current = *head;
 
@@ -305,11 +190,15 @@ void sortAddresses(struct Address **head) {
         count++;
         current = current->next;
     }
+    if (count < 2)
+        return;
 
-    struct Address **addressArray = (struct Address **)malloc(count * sizeof(struct Address *));
-    if (!addressArray) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+    if (count > addressArraySize) {
+        if (!(addressArray = (struct Address **)realloc(addressArray, count * sizeof(struct Address *)))) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        addressArraySize = count;
     }
 
     current = *head;
@@ -327,12 +216,12 @@ void sortAddresses(struct Address **head) {
         addressArray[i]->next = addressArray[i + 1];
     }
     addressArray[count - 1]->next = NULL;
-
-    free(addressArray);
 }
 
 void sortInterfaces(struct Interface **head) {
-    // Convert linked list to array
+    // Convert linked list to array, kept for the next sort
+    static struct Interface **interfaceArray = NULL;
+    static int interfaceArraySize = 0;
     int count = 0;
     struct Interface *current = *head;
 
@@ -340,11 +229,15 @@ void sortInterfaces(struct Interface **head) {
         count++;
         current = current->next;
     }
+    if (count == 0)
+        return;
 
-    struct Interface **interfaceArray = (struct Interface **)malloc(count * sizeof(struct Interface *));
-    if (!interfaceArray) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+    if (count > interfaceArraySize) {
+        if (!(interfaceArray = (struct Interface **)realloc(interfaceArray, count * sizeof(struct Interface *)))) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        interfaceArraySize = count;
     }
 
     current = *head;
@@ -363,43 +256,17 @@ void sortInterfaces(struct Interface **head) {
         interfaceArray[i]->next = interfaceArray[i + 1];
     }
     interfaceArray[count - 1]->next = NULL;
-
-    free(interfaceArray);
 }
 
-void sortConnections(struct Connection **head) {
-    int count = 0;
-    struct Connection *current = *head;
-
-    while (current != NULL) {
-        count++;
-        current = current->next;
-    }
-
-    // Convert linked list to array
-    struct Connection **connectionArray = (struct Connection **)malloc(count * sizeof(struct Connection *));
-    if (!connectionArray) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
-    }
-
-    current = *head;
-    for (int i = 0; i < count; i++) {
-        connectionArray[i] = current;
-        current = current->next;
-    }
-
-    // Sort the array using qsort
-    qsort(connectionArray, count, sizeof(struct Connection *), compare);
-
-    // Reconstruct the linked list
-    *head = connectionArray[0];
-    for (int i = 0; i < count - 1; i++) {
-        connectionArray[i]->next = connectionArray[i + 1];
-    }
-    connectionArray[count - 1]->next = NULL;
+/* sorts the count connections of conns indexed by list in the sort order (-s) */
+void sortConnections(const struct Connections *conns, uint32_t *list, int count) {
+    compare_conns = conns;
+    qsort(list, count, sizeof(uint32_t), compare_connections);
+}
 
-    free(connectionArray);
+/* orders connections (of compare_conns) by namespace, so that routing them enters each namespace once */
+int compare_netns(const void *a, const void *b) {
+    return compare_conns->netns[*(const uint32_t *)a] - compare_conns->netns[*(const uint32_t *)b];
 }
 
 int compare_addresses(const void *a, const void *b) {
@@ -409,9 +276,75 @@ int compare_addresses(const void *a, const void *b) {
     return strcmp(addra->ip, addrb->ip);
 }
 
-int compare(const void *a, const void *b) {
+/* orders connections (indexes into compare_conns) in the sort order (-s) */
+int compare_connections(const void *a, const void *b) {
+    const struct Connections *conns = compare_conns;
+    uint32_t conn_a = *(const uint32_t *)a;
+    uint32_t conn_b = *(const uint32_t *)b;
     uint32_t v1 = 0, v2 = 0;
 
+    switch (NFTOP_U_SORT_FIELD) {
+        case NFTOP_SORT_SUM:
+            v1 = conns->bps_sum[conn_a];
+            v2 = conns->bps_sum[conn_b];
+            break;
+        case NFTOP_SORT_AGE:
+            v1 = conns->delta[conn_a];
+            v2 = conns->delta[conn_b];
+            break;
+        case NFTOP_SORT_ID:
+            v1 = conns->id[conn_a];
+            v2 = conns->id[conn_b];
+            break;
+        case NFTOP_SORT_RX:
+            v1 = conns->bps_rx[conn_a];
+            v2 = conns->bps_rx[conn_b];
+            break;
+        case NFTOP_SORT_TX:
+            v1 = conns->bps_tx[conn_a];
+            v2 = conns->bps_tx[conn_b];
+            break;
+        case NFTOP_SORT_SPORT:
+            v1 = conns->sport[conn_a];
+            v2 = conns->sport[conn_b];
+            break;
+        case NFTOP_SORT_DPORT:
+            v1 = conns->dport[conn_a];
+            v2 = conns->dport[conn_b];
+            break;
+        case NFTOP_SORT_PROTO:
+            v1 = conns->proto_l4[conn_a];
+            v2 = conns->proto_l4[conn_b];
+            break;
+        case NFTOP_SORT_IN:
+            if (NFTOP_U_SORT_ASC == 1) {
+                return strcmp(internedString(conns->info[conn_b]->net_in_dev), internedString(conns->info[conn_a]->net_in_dev));
+            }
+            return strcmp(internedString(conns->info[conn_a]->net_in_dev), internedString(conns->info[conn_b]->net_in_dev));
+            break;
+        case NFTOP_SORT_OUT:
+            if (NFTOP_U_SORT_ASC == 1) {
+                return strcmp(internedString(conns->info[conn_b]->net_out_dev), internedString(conns->info[conn_a]->net_out_dev));
+            }
+            return strcmp(internedString(conns->info[conn_a]->net_out_dev), internedString(conns->info[conn_b]->net_out_dev));
+            break;
+        default:
+            return 0;
+    }
+
+    if (!v1 || !v2)
+        return 0;
+
+    if (v1 > v2) {
+        return (NFTOP_U_SORT_ASC == 1) ? 1 : -1;
+    } else if (v1 < v2) {
+        return (NFTOP_U_SORT_ASC == 1) ? -1 : 1;
+    } else {
+        return 0;
+    }
+}
+
+int compare(const void *a, const void *b) {
     if (a == NULL || b == NULL) {
         return 0;
     }
@@ -431,72 +364,7 @@ int compare(const void *a, const void *b) {
                 return 0;
         }
     } else {
-        const struct Connection *conn_a = *(const struct Connection **)a;
-        const struct Connection *conn_b = *(const struct Connection **)b;
-
-        if (conn_a == NULL || conn_b == NULL) {
-            return 0;
-        }
-
-        switch (NFTOP_U_SORT_FIELD) {
-            case NFTOP_SORT_SUM:
-                v1 = conn_a->bps_sum;
-                v2 = conn_b->bps_sum;
-                break;
-            case NFTOP_SORT_AGE:
-                v1 = conn_a->delta;
-                v2 = conn_b->delta;
-                break;
-            case NFTOP_SORT_ID:
-                v1 = conn_a->id;
-                v2 = conn_b->id;
-                break;
-            case NFTOP_SORT_RX:
-                v1 = conn_a->bps_rx;
-                v2 = conn_b->bps_rx;
-                break;
-            case NFTOP_SORT_TX:
-                v1 = conn_a->bps_tx;
-                v2 = conn_b->bps_tx;
-                break;
-            case NFTOP_SORT_SPORT:
-                v1 = conn_a->local.sport;
-                v2 = conn_b->local.sport;
-                break;
-            case NFTOP_SORT_DPORT:
-                v1 = conn_a->local.dport;
-                v2 = conn_b->local.dport;
-                break;
-            case NFTOP_SORT_PROTO:
-                v1 = conn_a->proto_l4;
-                v2 = conn_b->proto_l4;
-                break;
-            case NFTOP_SORT_IN:
-                if (NFTOP_U_SORT_ASC == 1) {
-                    return strcmp(conn_b->net_in_dev.name, conn_a->net_in_dev.name);
-                }
-                return strcmp(conn_a->net_in_dev.name, conn_b->net_in_dev.name);
-                break;
-            case NFTOP_SORT_OUT:
-                if (NFTOP_U_SORT_ASC == 1) {
-                    return strcmp(conn_b->net_out_dev.name, conn_a->net_out_dev.name);
-                }
-                return strcmp(conn_a->net_out_dev.name, conn_b->net_out_dev.name);
-                break;
-            default:
-                return 0;
-        }
-    }
-
-    if (!v1 || !v2)
-        return 0;
-
-    if (v1 > v2) {
-        return (NFTOP_U_SORT_ASC == 1) ? 1 : -1;
-    } else if (v1 < v2) {
-        return (NFTOP_U_SORT_ASC == 1) ? -1 : 1;
-    } else {
-        return 0;
+        return compare_connections(a, b);
     }
 }
 
@@ -544,7 +412,7 @@ int getUserInteger(int min, long int max) {
     return -127;
 }
 
-int wait_char(int t) {
+int wait_char(double t) {
 #ifdef ENABLE_NCURSES
     int c;
 #else
@@ -554,7 +422,7 @@ int wait_char(int t) {
     int i = 0;
     int usec_div = 50000;
 
-    while (i < (t * (USEC_PER_SEC/usec_div)) && !NFTOP_FLAGS_EXIT) {
+    while (i < (int)(t * (USEC_PER_SEC/usec_div) + 0.5) && !NFTOP_FLAGS_EXIT) {
         if (!is_redirected()) {
 #ifdef ENABLE_NCURSES
             c = wgetch(w);
@@ -646,6 +514,14 @@ int wait_char(int t) {
                     case 'I':
                         NFTOP_U_DISPLAY_ID = NFTOP_U_DISPLAY_ID ? 0 : 1;
                         return 0;
+                    case 'X':
+                        // cycle through the merged view and each namespace
+                        if (netnsConfigured()) {
+                            NFTOP_U_NETNS_VIEW++;
+                            if (NFTOP_U_NETNS_VIEW >= netnsCount())
+                                NFTOP_U_NETNS_VIEW = -1;
+                        }
+                        return 0;
                     case 'b':
                         NFTOP_U_BYTES = NFTOP_U_BYTES ? 0 : 1;
                         return 0;
@@ -685,6 +561,11 @@ int wait_char(int t) {
         if (!NFTOP_FLAGS_PAUSE)
             i += 1;
 
+        if (NFTOP_U_EVENTS)
+            eventsDrain();
+        else if (NFTOP_U_CLOSED)
+            closedDrain();
+
         usleep(usec_div);
     }
 
@@ -704,7 +585,7 @@ void interactiveHelp() {
     p\tToggle pause/resume output\n\
     d\tToggle interface list mode\n\
     a\tToggle connection age field (%s)%s\n\
-    u\tChange update interval (currently: %ds)\n\
+    u\tChange update interval (currently: %gs)\n\
     t\tChange threshold (currently: %d)\n\
     w\tToggle wide display format (%s)\n\
     b\tToggle report bytes, not bits (%s)\n\
@@ -718,6 +599,7 @@ void interactiveHelp() {
     R\tToggle obfuscation of the DEST IP address (%s)\n\
     n\tToggle name resolution of the SRC field (%s)\n\
     N\tToggle name resolution of the DEST field (%s)\n\
+    X\tCycle the network namespace shown (all, or one of -X)\n\
     q\tQuit/Exit\n",
         VERSION, NFTOP_U_DISPLAY_AGE ? status_on : status_off, NFTOP_FLAGS_TIMESTAMP ? "" : timestamp_avail_str,
         NFTOP_U_INTERVAL, NFTOP_U_THRESH, NFTOP_U_REPORT_WIDE ? status_on : status_off, NFTOP_U_BYTES ? status_on : status_off,
@@ -728,12 +610,371 @@ void interactiveHelp() {
         NFTOP_U_NUMERIC_SRC ? status_off : status_on, NFTOP_U_NUMERIC_DST ? status_off : status_on);
 }
 
+/* builds the interface list of the namespace the calling thread is in */
+struct Interface *load_devices(uint16_t netns) {
+    struct Interface *devices_list = NULL, *dev;
+    struct if_nameindex *if_nidxs;
+
+    // Retrieve a list of network interfaces
+    if_nidxs = if_nameindex();
+    if (if_nidxs == NULL) {
+        perror("if_nameindex");
+        exit(EXIT_FAILURE);
+    }
+
+    // the first interface heads the list whether or not it has addresses; the others are added with theirs
+    if (if_nidxs->if_index != 0)
+        add_interface(&devices_list, if_nidxs->if_name);
+
+    if_freenameindex(if_nidxs);
+
+    enumerateNetworkDevices(&devices_list);
+
+    for (dev = devices_list; dev != NULL; dev = dev->next)
+        dev->netns = netns;
+
+    return devices_list;
+}
+
+/* sets the rates of ct from those of its two directions, computed by ratesSelect() */
+void set_rates(struct Connections *conns, uint32_t ct, double bps_orig, double bps_repl, struct Interface **devices_list) {
+    bool is_local = isLocalAddress(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, devices_list);
+
+    if (is_local) {
+        // use bytes_repl as bps_tx
+        conns->bps_tx[ct] = bps_repl;
+        conns->bps_rx[ct] = bps_orig;
+    } else {
+        conns->bps_rx[ct] = bps_repl;
+        conns->bps_tx[ct] = bps_orig;
+    }
+    conns->bps_sum[ct] = conns->bps_rx[ct] + conns->bps_tx[ct];
+}
+
+/* queues the route lookups made when the interfaces of ct are matched, so that they go out in one batch */
+void queue_routes(const struct Connections *conns, uint32_t ct) {
+    if (conns->flags[ct] & (NFTOP_CT_SRC_NAT | NFTOP_CT_DST_NAT)) {
+        routeQueue(conns->proto_l3[ct], &conns->addrs[ct].orig_src, &in6addr_any, conns->mark[ct]);
+    } else {
+        routeQueue(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &conns->addrs[ct].orig_src, conns->mark[ct]);
+    }
+    routeQueue(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &in6addr_any, conns->mark[ct]);
+
+    // the lookup made when the first ones give no interface, or loopback
+    routeQueue(conns->proto_l3[ct], &conns->addrs[ct].orig_src, NULL, conns->mark[ct]);
+}
+
+/* moves the thread into the namespace of ct unless it is in it already; returns the namespace's devices */
+struct Interface **enter_netns(const struct Connections *conns, uint32_t ct, struct Interface **ns_devices) {
+    if (conns->netns[ct] != netnsCurrent())
+        netnsEnter(conns->netns[ct]);
+
+    return &ns_devices[conns->netns[ct]];
+}
+
+/* whether the interfaces of ct were carried over from its previous generation, with no route changed since */
+bool routes_carried(const struct Connections *conns, uint32_t ct) {
+    return conns->info[ct] != NULL && conns->info[ct]->route_epoch != 0 && conns->info[ct]->route_epoch == routeEpoch();
+}
+
+/* the device of the interned name, if the namespace has it */
+struct Interface *find_device(uint32_t name_id, struct Interface **devices_list) {
+    struct Interface *curr_dev;
+
+    for (curr_dev = *devices_list; curr_dev != NULL; curr_dev = curr_dev->next) {
+        if (curr_dev->name_id == name_id)
+            return curr_dev;
+    }
+
+    return NULL;
+}
+
+/*
+ * looks up the interfaces of ct, unless they were carried over, adds its rates to the totals of the
+ * interfaces and their addresses, and tells whether it passes the interface filters (-i, -o, and loopback)
+ */
+bool route_connection(struct Connections *conns, uint32_t ct, struct Interface **devices_list) {
+    struct ConnectionInfo *info = connectionInfo(conns, ct);
+    bool match = false;
+
+    struct Interface *net_in_dev, *net_out_dev;
+
+    if (routes_carried(conns, ct)) {
+        net_in_dev = find_device(info->net_in_dev, devices_list);
+        net_out_dev = find_device(info->net_out_dev, devices_list);
+    } else {
+        if (conns->flags[ct] & (NFTOP_CT_SRC_NAT | NFTOP_CT_DST_NAT)) {
+            net_in_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_src, &in6addr_any, conns->mark[ct], devices_list);
+        } else {
+            if (conns->proto_l3[ct] == AF_INET6) {
+                net_in_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &conns->addrs[ct].orig_src, conns->mark[ct], devices_list);
+            } else {
+                net_in_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &conns->addrs[ct].orig_src, conns->mark[ct], devices_list);
+            }
+        }
+
+        if (net_in_dev == NULL || strcmp(net_in_dev->name, "lo") == 0) {
+            net_in_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_src, NULL, conns->mark[ct], devices_list);
+        }
+
+        if (conns->flags[ct] & (NFTOP_CT_SRC_NAT | NFTOP_CT_DST_NAT)) {
+            net_out_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &in6addr_any, conns->mark[ct], devices_list);
+        } else {
+            net_out_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &in6addr_any, conns->mark[ct], devices_list);
+        }
+
+        if (net_out_dev == NULL || strcmp(net_out_dev->name, "lo") == 0) {
+            net_out_dev = getIfaceForRoute(conns->proto_l3[ct], &conns->addrs[ct].orig_src, NULL, conns->mark[ct], devices_list);
+        }
+
+        // kept for the next generations of the flow until a route, address or link changes
+        info->route_epoch = routeEpoch();
+    }
+
+    if (net_in_dev == NULL) {
+        info->net_in_dev = internString("*");
+        info->net_in_flags = 0;
+    } else {
+        net_in_dev->bps_tx += conns->bps_tx[ct];
+        net_in_dev->bps_rx += conns->bps_rx[ct];
+        net_in_dev->bps_sum += conns->bps_tx[ct] + conns->bps_rx[ct];
+        info->net_in_dev = net_in_dev->name_id;
+        info->net_in_flags = net_in_dev->flags;
+
+        struct Address *addr = net_in_dev->addresses;
+        while (addr) {
+            if (addr->s_addr.ss_family == conns->proto_l3[ct] && (addressEqual(conns->proto_l3[ct], &conns->addrs[ct].orig_src, &addr->raw)
+                || addressEqual(conns->proto_l3[ct], &conns->addrs[ct].repl_dst, &addr->raw) || addressEqual(conns->proto_l3[ct], &conns->addrs[ct].orig_dst, &addr->raw))) {
+                addr->bps_tx += conns->bps_tx[ct];
+                addr->bps_rx += conns->bps_rx[ct];
+                addr->bps_sum += conns->bps_tx[ct] + conns->bps_rx[ct];
+                break;
+            }
+            addr = addr->next;
+        }
+    }
+
+    if (net_out_dev == NULL) {
+        info->net_out_dev = internString("*");
+    } else {
+        if (net_in_dev != net_out_dev) {
+            net_out_dev->bps_tx += conns->bps_tx[ct];
+            net_out_dev->bps_rx += conns->bps_rx[ct];
+            net_out_dev->bps_sum = conns->bps_tx[ct] + conns->bps_rx[ct];
+
+            struct Address *addr = net_out_dev->addresses;
+            while (addr) {
+                if (addr->s_addr.ss_family == conns->proto_l3[ct] && (addressEqual(conns->proto_l3[ct], &conns->addrs[ct].repl_src, &addr->raw)
+                    || addressEqual(conns->proto_l3[ct], &conns->addrs[ct].repl_dst, &addr->raw) || addressEqual(conns->proto_l3[ct], &conns->addrs[ct].orig_src, &addr->raw))) {
+                    addr->bps_tx += conns->bps_tx[ct];
+                    addr->bps_rx += conns->bps_rx[ct];
+                    addr->bps_sum += conns->bps_tx[ct] + conns->bps_rx[ct];
+                    break;
+                }
+                addr = addr->next;
+            }
+        }
+        info->net_out_dev = net_out_dev->name_id;
+    }
+
+    if (NFTOP_U_IN_IFACE == NULL && NFTOP_U_OUT_IFACE == NULL) {
+        match = true;
+    } else if (NFTOP_U_IN_IFACE != NULL) {
+        if (NFTOP_U_IN_IFACE_FUZZY == 1) {
+            match = strncmp(internedString(info->net_in_dev), NFTOP_U_IN_IFACE, (sizeof(char))*(strlen(NFTOP_U_IN_IFACE))) == 0;
+        } else {
+            match = strcmp(internedString(info->net_in_dev), NFTOP_U_IN_IFACE) == 0;
+        }
+    } else if (NFTOP_U_OUT_IFACE != NULL) {
+        if (NFTOP_U_OUT_IFACE_FUZZY == 1) {
+            match = strncmp(internedString(info->net_out_dev), NFTOP_U_OUT_IFACE, (sizeof(char))*(strlen(NFTOP_U_OUT_IFACE))) == 0;
+        } else {
+            match = strcmp(internedString(info->net_out_dev), NFTOP_U_OUT_IFACE) == 0;
+        }
+    }
+
+    if ((info->net_in_flags & IFF_LOOPBACK) && NFTOP_U_NO_LOOPBACK == 1) {
+        match = false;
+    }
+
+    return match;
+}
+
+/*
+ * looks up the interfaces of the count connections of list, NFTOP_ROUTE_BATCH connections at a time,
+ * and moves those that pass the interface filters to the front of list; returns how many did
+ */
+int route_connections(struct Connections *conns, uint32_t *list, int count, struct Interface **ns_devices) {
+    uint32_t tmp;
+    int batch, end, i, kept = 0;
+
+    for (batch = 0; batch < count; batch = end) {
+        end = batch + NFTOP_ROUTE_BATCH < count ? batch + NFTOP_ROUTE_BATCH : count;
+
+        // the lookups of the whole batch go out together, one datagram per namespace
+        for (i = batch; i < end; i++) {
+            enter_netns(conns, list[i], ns_devices);
+            if (!routes_carried(conns, list[i]))
+                queue_routes(conns, list[i]);
+        }
+        routeFlush();
+
+        // the ones filtered out are swapped to the back
+        for (i = batch; i < end; i++) {
+            if (route_connection(conns, list[i], enter_netns(conns, list[i], ns_devices))) {
+                tmp = list[kept];
+                list[kept++] = list[i];
+                list[i] = tmp;
+            }
+        }
+    }
+
+    return kept;
+}
+
+/*
+ * moves the k first connections of list in the sort order (-s) to its front and sorts them, leaving
+ * the rest in any order: a quickselect, then a sort of k rather than of count connections
+ */
+void select_top(struct Connections *conns, uint32_t *list, int count, int k) {
+    uint32_t pivot, tmp;
+    int lo = 0, hi = count - 1, i, j;
+
+    if (k <= 0)
+        return;
+
+    compare_conns = conns;
+    while (lo < hi) {
+        pivot = list[lo + (hi - lo) / 2];
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (i <= hi && compare_connections(&list[i], &pivot) < 0)
+                i++;
+            while (j >= lo && compare_connections(&list[j], &pivot) > 0)
+                j--;
+            if (i <= j) {
+                tmp = list[i];
+                list[i++] = list[j];
+                list[j--] = tmp;
+            }
+        }
+
+        if (k - 1 <= j)
+            hi = j;
+        else if (k - 1 >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    sortConnections(conns, list, k < count ? k : count);
+}
+
+/*
+ * sets the interval of the next cycle from the CPU time used by the last one (cpu, over wall): stretched at
+ * once to stay within --cpu-budget, and shrunk back gradually towards -u; host name lookups (dns_cpu of
+ * the cycle) are suspended first when the rest of the cycle fits the budget at the requested interval
+ */
+void budget_adapt(uint64_t cpu, uint64_t wall, uint64_t dns_cpu) {
+    static int dns_probe = 0;
+    double budget, target;
+
+    NFTOP_CYCLE_CPU = cpu;
+    NFTOP_CYCLE_LOAD = wall > 0 ? 100.0 * cpu / wall : 0;
+
+    if (NFTOP_U_CPU_BUDGET <= 0) {
+        NFTOP_INTERVAL = NFTOP_U_INTERVAL;
+        return;
+    }
+
+    // CPU nanoseconds a cycle may use at the requested interval
+    budget = NFTOP_U_CPU_BUDGET / 100 * NFTOP_U_INTERVAL * NSEC_PER_SEC;
+
+    if (NFTOP_FLAGS_SKIP_DNS) {
+        // resolved names are cached, so the lookups may fit again after a while
+        if (++dns_probe >= NFTOP_BUDGET_DNS_PROBE) {
+            NFTOP_FLAGS_SKIP_DNS = 0;
+            dns_probe = 0;
+        }
+    } else if (cpu > budget && cpu - dns_cpu <= budget) {
+        NFTOP_FLAGS_SKIP_DNS = 1;
+        cpu -= dns_cpu;
+    }
+
+    target = (double)cpu / NSEC_PER_SEC * 100 / NFTOP_U_CPU_BUDGET;
+    if (target < NFTOP_U_INTERVAL)
+        target = NFTOP_U_INTERVAL;
+    if (target > NFTOP_U_INTERVAL * NFTOP_BUDGET_MAX_STRETCH)
+        target = NFTOP_U_INTERVAL * NFTOP_BUDGET_MAX_STRETCH;
+
+    NFTOP_INTERVAL = target > NFTOP_INTERVAL ? target : (NFTOP_INTERVAL + target) / 2;
+}
+
+/* watch mode (-W): polls a single connection every interval, one NFCT_Q_GET round trip each, until it is gone */
+void watch_loop() {
+    struct WatchSample samples[NFTOP_WATCH_HISTORY];
+    struct Flow flow, prev;
+    size_t count = 0;
+    double per_sec;
+
+    memset(&prev, 0, sizeof(struct Flow));
+
+    while (!NFTOP_FLAGS_EXIT) {
+        if (!NFTOP_FLAGS_PAUSE) {
+            if (queryWatch(&flow) == -1) {
+                displayClose();
+                if (errno == ENOENT)
+                    fprintf(stderr, "Connection %u is gone\n", prev.id);
+                else
+                    fprintf(stderr, "error: (%d)(%s)\n", -1, strerror(errno));
+                exit(errno == ENOENT ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+
+            // a new flow on the same tuple starts a new graph
+            if (flow.id != prev.id)
+                count = 0;
+
+            if (prev.time_seen > 0 && flow.id == prev.id && flow.time_seen > prev.time_seen) {
+                if (count == NFTOP_WATCH_HISTORY) {
+                    memmove(samples, samples + 1, (NFTOP_WATCH_HISTORY - 1) * sizeof(struct WatchSample));
+                    count--;
+                }
+
+                per_sec = (double)NSEC_PER_SEC / (flow.time_seen - prev.time_seen);
+                samples[count].bps_orig = (flow.bytes_orig - prev.bytes_orig) * 8 * per_sec;
+                samples[count].bps_repl = (flow.bytes_repl - prev.bytes_repl) * 8 * per_sec;
+                count++;
+            }
+            memcpy(&prev, &flow, sizeof(struct Flow));
+        }
+
+        displayWatch(&prev, samples, count);
+        displayRefresh();
+
+        NFTOP_FLAGS_PAUSE = wait_char(NFTOP_U_INTERVAL) != 0;
+    }
+}
+
 int main(int argc, char **argv) {
-    struct Connection *current_head_ct = NULL;
-    struct Connection *history_head_ct = NULL;
-    struct Connection *curr_ct = NULL;
-    struct Connection *hist_ct = NULL;
-    uint32_t delta_delta;
+    struct Connections *conns = NULL;      // the current generation
+    const struct Connections *history;      // the previous one
+    struct HistoryIndex history_index = { NULL, 0, 0 };     // history by (id, time_start)
+    uint32_t curr_ct;
+    ssize_t hist_ct;
+    uint32_t *display_list = NULL;     // connections of the current generation matching the filters, the rows shown first
+    int display_size = 0;
+    struct RateColumns rates = { 0 };   // the counters of the current generation, display_list's order
+    uint64_t elapsed;
+    uint64_t interval_ns;
+    bool primed = false;    // a previous dump exists to compute rates against
+    uint64_t cycle_cpu = 0, cycle_wall = 0, dns_cpu = 0, now_cpu, now_wall;
+    uint64_t stage_collect, stage_join, stage_display;
+    bool interval_set = false;
+#ifdef NFTOP_ALLOC_COUNT
+    uint64_t alloc_count = 0;   // allocations until the end of the previous refresh
+    int refreshes = 0;
+#endif
 
     int c, option_index = 0;
     opterr = 0;
@@ -751,6 +992,19 @@ int main(int argc, char **argv) {
         {"numeric-remote",  no_argument, 	   0, 'N'}, // numeric remote IP
         {"disable-dns",     no_argument,       0, 'x'}, // disable dns resolution of both local and dest IPs and s/dports
         {"dev",             no_argument,       0, 'd'}, // devices only
+        {"events",          no_argument,       0, 'e'}, // maintain the table from conntrack events
+        {"resync",          required_argument, 0, 'E'}, // intervals between full dumps in event mode
+        {"nfct-parse",      no_argument,       0, 'F'}, // parse dumps with libnetfilter_conntrack (reference parser)
+        {"mark",            required_argument, 0, 'k'}, // connection mark filter (value[/mask])
+        {"zone",            required_argument, 0, 'z'}, // conntrack zone filter
+        {"rcvbuf",          required_argument, 0, 'K'}, // netlink socket receive buffer size
+        {"netns",           required_argument, 0, 'X'}, // collect from a network namespace (repeatable)
+        {"closed",          no_argument,       0, 'C'}, // account flows closed between dumps from DESTROY events
+        {"zero",            no_argument,       0, 'Z'}, // dump-and-reset counters instead of joining with the previous dump
+        {"shards",          required_argument, 0, 'H'}, // dump one mark-selected shard of the table per interval
+        {"cpu-budget",      required_argument, 0, 'U'}, // adapt the interval to a CPU usage budget (percent)
+        {"watch",           required_argument, 0, 'W'}, // poll a single connection (ID or tuple)
+        {"file",            required_argument, 0, 'f'}, // read the table from /proc/net/nf_conntrack (or a file in its format)
         {"debug",           no_argument,       0, 'D'}, // output debug information to stderr
         {"numeric-port", 	no_argument,       0, 'P'}, // numeric port
         {"redact-local", 	no_argument,       0, 'r'}, // replace the local address/hostname with "REDACTED"
@@ -774,10 +1028,11 @@ int main(int argc, char **argv) {
         {0, 0, 0, 0}
     };
 
-    while ((c = getopt_long(argc, argv, "46bBcdDhIlnNmprRSwvVa:s:t:u:i:o:", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "46bBcCdDeFhIlnNmprRSwvVxZa:E:f:H:k:K:s:t:u:U:i:o:W:X:z:", long_options, &option_index)) != -1) {
         switch (c) {
             case 'h':
                 printf(USAGE_STRING);
+                printf(USAGE_EXAMPLES_STRING);
                 exit(EXIT_SUCCESS);
             case 'd':
                 NFTOP_FLAGS_DEV_ONLY = 1;
@@ -785,6 +1040,72 @@ int main(int argc, char **argv) {
             case 'D':
                 NFTOP_FLAGS_DEBUG = 1;
                 break;
+            case 'e':
+                NFTOP_U_EVENTS = 1;
+                break;
+            case 'F':
+                NFTOP_U_NFCT_PARSE = 1;
+                break;
+            case 'k': {
+                char *mask_str = NULL;
+                NFTOP_U_MARK = strtoul(optarg, &mask_str, 0);
+                NFTOP_U_MARK_MASK = 0xffffffff;
+
+                if (mask_str == optarg || (*mask_str != '\0' && *mask_str != '/')) {
+                    fprintf(stderr, "Option -%c requires a mark in the form value[/mask]\n", c);
+                    exit(EXIT_FAILURE);
+                }
+                if (*mask_str == '/')
+                    NFTOP_U_MARK_MASK = strtoul(mask_str + 1, NULL, 0);
+
+                NFTOP_U_MARK &= NFTOP_U_MARK_MASK;
+                break;
+            }
+            case 'Z':
+                NFTOP_U_ZERO = 1;
+                break;
+            case 'H': {
+                char *end = NULL;
+                uint32_t bits;
+
+                NFTOP_U_SHARD_MASK = strtoul(optarg, &end, 0);
+                bits = NFTOP_U_SHARD_MASK ? NFTOP_U_SHARD_MASK >> __builtin_ctz(NFTOP_U_SHARD_MASK) : 0;
+
+                // contiguous bits, so that each shard is a single mark value under the mask
+                if (end == optarg || *end != '\0' || bits == 0 || (bits & (bits + 1)) != 0 || bits >= NFTOP_MAX_SHARDS) {
+                    fprintf(stderr, "Option -%c requires a mask of contiguous mark bits (at most %d shards)\n", c, NFTOP_MAX_SHARDS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'X':
+                if (netnsAdd(optarg) == -1)
+                    exit(EXIT_FAILURE);
+                break;
+            case 'C':
+                NFTOP_U_CLOSED = 1;
+                break;
+            case 'K':
+                if (isalpha(*optarg) || atoi(optarg) < 1) {
+                    fprintf(stderr, "Option -%c requires a size in bytes\n", c);
+                    exit(EXIT_FAILURE);
+                }
+                NFTOP_U_RCVBUF = atoi(optarg);
+                break;
+            case 'z':
+                if (isalpha(*optarg) || atoi(optarg) < 0 || atoi(optarg) > 65535) {
+                    fprintf(stderr, "Option -%c requires a zone from 0 to 65535\n", c);
+                    exit(EXIT_FAILURE);
+                }
+                NFTOP_U_ZONE = atoi(optarg);
+                break;
+            case 'E':
+                if (isalpha(*optarg) || atoi(optarg) < 1) {
+                    fprintf(stderr, "Option -%c requires a number\n", c);
+                    exit(EXIT_FAILURE);
+                }
+                NFTOP_U_EVENT_RESYNC = atoi(optarg);
+                break;
             case 'a':
                 if (isalpha(*optarg) || atoi(optarg) > 2) {
                     fprintf(stderr, "Option -%c requires a numeric value of 0, 1 or 2\n", c);
@@ -812,11 +1133,25 @@ int main(int argc, char **argv) {
                 NFTOP_U_THRESH = atoll(optarg);
                 break;
             case 'u':
-                if (isalpha(*optarg) || atoi(optarg) < 1) {
-                    fprintf(stderr, "Option -%c requires a number\n", optopt);
+                if (isalpha(*optarg) || strtod(optarg, NULL) < NFTOP_MIN_INTERVAL) {
+                    fprintf(stderr, "Option -%c requires a number of seconds (minimum %g)\n", c, NFTOP_MIN_INTERVAL);
+                    exit(EXIT_FAILURE);
+                }
+                NFTOP_U_INTERVAL = strtod(optarg, NULL);
+                interval_set = true;
+                break;
+            case 'W':
+                NFTOP_U_WATCH = optarg;
+                break;
+            case 'f':
+                NFTOP_U_PROC_FILE = optarg;
+                break;
+            case 'U':
+                if (isalpha(*optarg) || strtod(optarg, NULL) <= 0) {
+                    fprintf(stderr, "Option -%c requires a percentage of a CPU\n", c);
                     exit(EXIT_FAILURE);
                 }
-                NFTOP_U_INTERVAL = atoi(optarg);
+                NFTOP_U_CPU_BUDGET = strtod(optarg, NULL);
                 break;
             case 'i':
                 NFTOP_U_IN_IFACE = optarg;
@@ -920,7 +1255,7 @@ int main(int argc, char **argv) {
                 NFTOP_U_MACHINE = 1;
                 break;
             case '?':
-                if (optopt == 'a' || optopt == 't' || optopt == 'u' || optopt == 's' || optopt == 'S') {
+                if (optopt == 'a' || optopt == 'E' || optopt == 'f' || optopt == 'H' || optopt == 'k' || optopt == 'K' || optopt == 'X' || optopt == 'z' || optopt == 't' || optopt == 'u' || optopt == 'U' || optopt == 'W' || optopt == 's' || optopt == 'S') {
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 } else if (isprint (optopt)) {
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -936,6 +1271,64 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (NFTOP_U_EVENTS && NFTOP_U_ZERO) {
+        fprintf(stderr, "Options -e and -Z are mutually exclusive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (netnsConfigured() && (NFTOP_U_EVENTS || NFTOP_U_CLOSED)) {
+        fprintf(stderr, "Option -X can not be combined with -e or -C\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the shards' flow table is keyed by conntrack ID, which is only unique within a namespace
+    if (NFTOP_U_SHARD_MASK && (NFTOP_U_EVENTS || NFTOP_U_ZERO || netnsConfigured())) {
+        fprintf(stderr, "Option -H can not be combined with -e, -Z or -X\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (NFTOP_U_SHARD_MASK & NFTOP_U_MARK_MASK) {
+        fprintf(stderr, "The masks of -H and -k must not overlap\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (NFTOP_U_WATCH && (NFTOP_U_EVENTS || NFTOP_U_SHARD_MASK || netnsConfigured())) {
+        fprintf(stderr, "Option -W can not be combined with -e, -H or -X\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the file carries neither events nor the conntrack IDs the other collectors key on
+    if (NFTOP_U_PROC_FILE && (NFTOP_U_EVENTS || NFTOP_U_CLOSED || NFTOP_U_ZERO || NFTOP_U_SHARD_MASK || NFTOP_U_WATCH || netnsConfigured())) {
+        fprintf(stderr, "Option -f can not be combined with -e, -C, -Z, -H, -W or -X\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (NFTOP_U_WATCH) {
+        if (!interval_set)
+            NFTOP_U_INTERVAL = NFTOP_WATCH_INTERVAL;
+        if (watchOpen(NFTOP_U_WATCH) == -1)
+            exit(EXIT_FAILURE);
+
+        displayInit();
+        watch_loop();
+        watchClose();
+        displayClose();
+        return 0;
+    }
+
+    NFTOP_INTERVAL = NFTOP_U_INTERVAL;
+
+    if (NFTOP_U_EVENTS) {
+        if (eventsOpen() == -1)
+            exit(EXIT_FAILURE);
+    } else if (!NFTOP_U_PROC_FILE && openNFCT() == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // in event mode, DESTROY events already arrive on the event socket
+    if (NFTOP_U_CLOSED && !NFTOP_U_EVENTS && closedOpen() == -1)
+        exit(EXIT_FAILURE);
+
     displayInit();
 
     int ret = 0;
@@ -947,116 +1340,123 @@ int main(int argc, char **argv) {
     struct Interface *devices_list = NULL;
 
     while (ret != -1 && NFTOP_FLAGS_EXIT != 1) {
-        struct if_nameindex *if_nidxs, *intf;
-        int numInterfaces = 0;
-
-        // Retrieve a list of network interfaces
-        if_nidxs = if_nameindex();
-        if (if_nidxs == NULL) {
-            perror("if_nameindex");
-            exit(EXIT_FAILURE);
+        struct Interface *ns_devices[netnsCount()], **dev_tail;
+        int ns;
+
+        // the cost of the previous cycle, waiting (and draining events) included, sets this one's interval
+        now_cpu = process_cpu_ns();
+        now_wall = monotonic_ns();
+        if (cycle_wall > 0)
+            budget_adapt(now_cpu - cycle_cpu, now_wall - cycle_wall, dns_cpu);
+        cycle_cpu = now_cpu;
+        cycle_wall = now_wall;
+        dns_cpu = 0;
+
+        // interfaces, addresses and routes are looked up inside the namespace of each connection
+        for (ns = 0; ns < netnsCount(); ns++) {
+            ns_devices[ns] = NULL;
+            if (netnsEnter(ns) == 0)
+                ns_devices[ns] = load_devices(ns);
         }
+        netnsRestore();
+        devices_list = ns_devices[0];
 
-        // Count the number of interfaces
-        for (intf = if_nidxs; intf->if_index != 0 || intf->if_name != NULL; intf++) {
-            numInterfaces++;
-        }
+        // routes are looked up again every interval
+        routeReset();
 
-        // Allocate memory for the interfaces
-        devices_list = (struct Interface *)malloc(numInterfaces * sizeof(struct Interface));
-        if (devices_list == NULL) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
-        memset(devices_list, 0, numInterfaces*sizeof(struct Interface));
+        // the connections of two intervals ago are no longer needed; their columns take this interval's
+        arenaSwap();
+        conns = arenaConnections();
+        history = arenaPrevious();
 
-        // Copy interface names to the structure
-        for (intf = if_nidxs; intf->if_index != 0 || intf->if_name != NULL; intf++) {
-            strncpy(devices_list[intf - if_nidxs].name, intf->if_name, IFNAMSIZ-1);
-        }
-
-        if_freenameindex(if_nidxs);
-
-        enumerateNetworkDevices(&devices_list);
+        // the header shows the file's entries rather than the live table's size
+        if (!NFTOP_U_PROC_FILE)
+            queryStats();
 
-        if (!(current_head_ct = (struct Connection *)malloc(sizeof(struct Connection)))) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
-        }
-        memset(current_head_ct, 0, sizeof(struct Connection));
-
-        ret = queryNFCT(current_head_ct);
-        curr_ct = current_head_ct;
-        curr_ct->bps_rx = 0;
-        curr_ct->bps_tx = 0;
-        curr_ct->bps_sum = 0;
-        struct Connection *displayArray;
-        if (!(displayArray = (struct Connection *)malloc(sizeof(struct Connection)))) {
-            perror("malloc");
-            exit(EXIT_FAILURE);
+        if (NFTOP_U_EVENTS) {
+            ret = queryEvents(conns);
+        } else if (NFTOP_U_PROC_FILE) {
+            ret = queryProc(conns, NFTOP_U_PROC_FILE);
+        } else {
+            ret = queryNFCT(conns);
         }
-        memset(displayArray, 0, sizeof(struct Connection));
+        stage_collect = monotonic_ns();
 
         bool match = false;
-        int array_pos = 0;
-        struct Connection *display_head = displayArray;
+        bool routes_first, sorted;
+        int array_pos = 0, flows = 0, candidates = 0, carried = 0, routed = 0, resolved = 0, hosts, rows, selected, take, kept;
+        int i;
+
+        // fallback for counters observed without a timestamp to compare against
+        interval_ns = NFTOP_INTERVAL * NSEC_PER_SEC;
+        if (interval_ns < NFTOP_MIN_INTERVAL * NSEC_PER_SEC)
+            interval_ns = NFTOP_MIN_INTERVAL * NSEC_PER_SEC;
+
+        if (primed) {
+            // the counters of every flow and the filters that need nothing but them, gathered into columns
+            // for ratesSelect()
+            for (curr_ct = 0; curr_ct < conns->count; curr_ct++, flows++) {
+                if (flows == display_size) {
+                    display_size = display_size ? display_size * 2 : NFTOP_DISPLAY_COUNT;
+                    if (!(display_list = realloc(display_list, display_size * sizeof(uint32_t)))) {
+                        perror("realloc");
+                        exit(EXIT_FAILURE);
+                    }
+                    ratesReserve(&rates, display_size);
+                }
+                display_list[flows] = curr_ct;
+
+                // no rate without a source of the interval's bytes
+                rates.bytes_orig[flows] = 0;
+                rates.bytes_repl[flows] = 0;
+                rates.elapsed[flows] = NSEC_PER_SEC;
+
+                // the counters were zeroed by the previous dump: they are the bytes of this interval
+                if (NFTOP_U_ZERO) {
+                    rates.bytes_orig[flows] = conns->bytes_orig[curr_ct];
+                    rates.bytes_repl[flows] = conns->bytes_repl[curr_ct];
+                    rates.elapsed[flows] = NFTOP_DUMP_ELAPSED > 0 ? NFTOP_DUMP_ELAPSED : interval_ns;
+                }
 
-        if (history_head_ct != NULL) {
-            while(curr_ct != NULL) {
-                if (array_pos >= NFTOP_DISPLAY_COUNT) {
-                    break;
+                // a sharded dump carries each flow's bytes since its own previous observation
+                if (conns->flags[curr_ct] & NFTOP_CT_SAMPLE) {
+                    rates.bytes_orig[flows] = conns->samples[curr_ct].orig;
+                    rates.bytes_repl[flows] = conns->samples[curr_ct].repl;
+                    rates.elapsed[flows] = conns->samples[curr_ct].ns;
                 }
-                hist_ct = history_head_ct;
 
-                while(hist_ct != NULL) {
-                    if (curr_ct->id == hist_ct->id &&
-                        curr_ct->time_start == hist_ct->time_start // ensure times match (ID re-use)
-                    ) {
-                        delta_delta = NFTOP_U_INTERVAL; // default to NFTOP_U_INTERVAL in case the delta of (item1->delta - item2->delta) has not changed
+                hist_ct = historyLookup(&history_index, conns->id[curr_ct], conns->time_start[curr_ct]);
 
-                        if (curr_ct->delta > 0 && curr_ct->delta != hist_ct->delta) {
-                            delta_delta = curr_ct->delta - hist_ct->delta;
-                        }
+                if (hist_ct != -1) {
+                    // rates are taken over the time between the two observations of the counters
+                    elapsed = interval_ns;
+                    if (conns->time_seen[curr_ct] > history->time_seen[hist_ct] && history->time_seen[hist_ct] > 0) {
+                        elapsed = conns->time_seen[curr_ct] - history->time_seen[hist_ct];
+                    }
 
-                        if (delta_delta > 0) {
-                            bool is_local = isLocalAddress(curr_ct->local.dst, &devices_list);
-                            if (curr_ct->bytes_repl - hist_ct->bytes_repl > 0) {
-                                if (is_local) {
-                                    // use bytes_repl as bps_tx
-                                    curr_ct->bps_tx = ((curr_ct->bytes_repl - hist_ct->bytes_repl) / delta_delta) * 8;
-                                } else {
-                                    curr_ct->bps_rx = ((curr_ct->bytes_repl - hist_ct->bytes_repl) / delta_delta) * 8;
-                                }
-                            }
-                            if (curr_ct->bytes_orig - hist_ct->bytes_orig > 0) {
-                                if (is_local) {
-                                    curr_ct->bps_rx = ((curr_ct->bytes_orig - hist_ct->bytes_orig) / delta_delta) * 8;
-                                } else {
-                                    curr_ct->bps_tx = ((curr_ct->bytes_orig - hist_ct->bytes_orig) / delta_delta) * 8;
-                                }
-                            }
-                            curr_ct->bps_sum = curr_ct->bps_rx + curr_ct->bps_tx;
-                        }
+                    rates.bytes_orig[flows] = conns->bytes_orig[curr_ct] - history->bytes_orig[hist_ct];
+                    rates.bytes_repl[flows] = conns->bytes_repl[curr_ct] - history->bytes_repl[hist_ct];
+                    rates.elapsed[flows] = elapsed;
 
-                        // // copy over the hostnames if already resolved so we don't need to hit the dns_cache
-                        // if (strlen(hist_ct->local.hostname_src) > 0) {
-                        //     memcpy(&curr_ct->local.hostname_src, hist_ct->local.hostname_src, sizeof(hist_ct->local.hostname_src));
-                        // }
-                        // if (strlen(hist_ct->local.hostname_dst) > 0) {
-                        //     memcpy(&curr_ct->local.hostname_dst, hist_ct->local.hostname_dst, sizeof(hist_ct->local.hostname_dst));
-                        // }
-
-                        // Moved below to only show total ct entries that match the filter.
-                        // TODO: add a NFTOP_{RX,TX}_MATCH and allow the user to toggle.
-                        // NFTOP_RX_ALL += curr_ct->bps_rx;
-                        // NFTOP_TX_ALL += curr_ct->bps_tx;
-                        break;
+                    // what was looked up for the previous generation holds for this one: the service and host
+                    // names for good, the interfaces until a route changes (see routes_carried())
+                    if (history->info[hist_ct] != NULL) {
+                        *connectionInfo(conns, curr_ct) = *history->info[hist_ct];
+                        carried++;
                     }
-                    hist_ct = hist_ct->next;
+                }
+
+                // a flow that closed without a previous sample: its final bytes belong to this interval,
+                // unless it lived longer (missed by the previous dump), then they are averaged over its age
+                if (hist_ct == -1 && (conns->flags[curr_ct] & NFTOP_CT_CLOSED) && !NFTOP_U_ZERO) {
+                    elapsed = (uint64_t)conns->delta[curr_ct] * NSEC_PER_SEC;
+                    rates.bytes_orig[flows] = conns->bytes_orig[curr_ct];
+                    rates.bytes_repl[flows] = conns->bytes_repl[curr_ct];
+                    rates.elapsed[flows] = elapsed > interval_ns ? elapsed : interval_ns;
                 }
 
                 // match true if L3 protocol matches
-                switch (curr_ct->proto_l3) {
+                switch (conns->proto_l3[curr_ct]) {
                     case AF_INET:
                         match = NFTOP_U_IPV4 ? true : false;
                         break;
@@ -1068,116 +1468,110 @@ int main(int argc, char **argv) {
                         break;
                 }
 
-                if (curr_ct->delta > 0 && curr_ct->bps_sum >= NFTOP_U_THRESH && match == true) {
-                    match = false; // reset the match to investigate higher details
-
-                    struct Interface *net_in_dev;
+                if (NFTOP_U_NETNS_VIEW >= 0 && conns->netns[curr_ct] != NFTOP_U_NETNS_VIEW)
+                    match = false;
 
-                    if (curr_ct->is_dst_nat || curr_ct->is_src_nat) {
-                        net_in_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.src_ip, &curr_ct->remote.dst_ip, curr_ct->mark, &devices_list);
-                    } else {
-                        if (curr_ct->proto_l3 == AF_INET6) {
-                            net_in_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.dst_ip, &curr_ct->local.src_ip, curr_ct->mark, &devices_list);
-                        } else {
-                            net_in_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.dst_ip, &curr_ct->local.src_ip, curr_ct->mark, &devices_list);
-                        }
-                    }
-
-                    if (net_in_dev == NULL || strcmp(net_in_dev->name, "lo") == 0) {
-                        net_in_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.src_ip, (struct sockaddr_storage *)NULL, curr_ct->mark, &devices_list);
-                    }
-
-                    if (net_in_dev == NULL) {
-                        strcpy(curr_ct->net_in_dev.name, "*");
-                    } else {
-                        net_in_dev->bps_tx += curr_ct->bps_tx;
-                        net_in_dev->bps_rx += curr_ct->bps_rx;
-                        net_in_dev->bps_sum += curr_ct->bps_tx + curr_ct->bps_rx;
-                        memcpy(&curr_ct->net_in_dev, net_in_dev, sizeof(struct Interface));
-
-                        struct Address *addr = net_in_dev->addresses;
-                        while (addr) {
-                            if (strcmp(curr_ct->local.src, addr->ip) == 0 || strcmp(curr_ct->remote.dst, addr->ip) == 0 || strcmp(curr_ct->local.dst, addr->ip) == 0) {
-                                addr->bps_tx += curr_ct->bps_tx;
-                                addr->bps_rx += curr_ct->bps_rx;
-                                addr->bps_sum += curr_ct->bps_tx + curr_ct->bps_rx;
-                                break;
-                            }
-                            addr = addr->next;
-                        }
-                    }
-
-                    struct Interface *net_out_dev;
-                    if (curr_ct->is_dst_nat || curr_ct->is_src_nat) {
-                        net_out_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.dst_ip, &curr_ct->remote.dst_ip, curr_ct->mark, &devices_list);
-                    } else {
-                        net_out_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.dst_ip, &curr_ct->remote.dst_ip, curr_ct->mark, &devices_list);
-                    }
-
-                    if (net_out_dev == NULL || strcmp(net_out_dev->name, "lo") == 0) {
-                        net_out_dev = getIfaceForRoute(curr_ct->proto_l3, &curr_ct->local.src_ip, (struct sockaddr_storage *)NULL, curr_ct->mark, &devices_list);
-                    }
+                rates.eligible[flows] = conns->delta[curr_ct] > 0 && match;
+            }
 
-                    if (net_out_dev == NULL) {
-                        strcpy(curr_ct->net_out_dev.name, "*");
-                    } else {
-                        if (net_in_dev != net_out_dev) {
-                            net_out_dev->bps_tx += curr_ct->bps_tx;
-                            net_out_dev->bps_rx += curr_ct->bps_rx;
-                            net_out_dev->bps_sum = curr_ct->bps_tx + curr_ct->bps_rx;
-
-                            struct Address *addr = net_out_dev->addresses;
-                            while (addr) {
-                                if (strcmp(curr_ct->remote.src, addr->ip) == 0 || strcmp(curr_ct->remote.dst, addr->ip)  == 0 || strcmp(curr_ct->local.src, addr->ip)  == 0) {
-                                    addr->bps_tx += curr_ct->bps_tx;
-                                    addr->bps_rx += curr_ct->bps_rx;
-                                    addr->bps_sum += curr_ct->bps_tx + curr_ct->bps_rx;
-                                    break;
-                                }
-                                addr = addr->next;
-                            }
-                        }
-                        memcpy(&curr_ct->net_out_dev, net_out_dev, sizeof(struct Interface));
-                    }
+            // the rates of all of them and the threshold in one pass; the selected move to the front, in order
+            rates.count = flows;
+            candidates = ratesSelect(&rates, NFTOP_U_THRESH);
+            for (i = 0; i < candidates; i++) {
+                curr_ct = display_list[rates.selected[i]];
+                // the partitions are merged namespace by namespace, so this switches once per namespace
+                set_rates(conns, curr_ct, rates.bps_orig[rates.selected[i]], rates.bps_repl[rates.selected[i]],
+                    enter_netns(conns, curr_ct, ns_devices));
+                display_list[i] = curr_ct;
+
+                // the totals of the header are those of the connections that match the filters
+                NFTOP_TX_ALL += conns->bps_tx[curr_ct];
+                NFTOP_RX_ALL += conns->bps_rx[curr_ct];
+            }
 
-                    if (NFTOP_U_IN_IFACE == NULL && NFTOP_U_OUT_IFACE == NULL) {
-                        match = true;
-                    } else if (NFTOP_U_IN_IFACE != NULL) {
-                        if (NFTOP_U_IN_IFACE_FUZZY == 1) {
-                            match = strncmp(curr_ct->net_in_dev.name, NFTOP_U_IN_IFACE, (sizeof(char))*(strlen(NFTOP_U_IN_IFACE))) == 0;
-                        } else {
-                            match = strcmp(curr_ct->net_in_dev.name, NFTOP_U_IN_IFACE) == 0;
-                        }
-                    } else if (NFTOP_U_OUT_IFACE != NULL) {
-                        if (NFTOP_U_OUT_IFACE_FUZZY == 1) {
-                            match = strncmp(curr_ct->net_out_dev.name, NFTOP_U_OUT_IFACE, (sizeof(char))*(strlen(NFTOP_U_OUT_IFACE))) == 0;
-                        } else {
-                            match = strcmp(curr_ct->net_out_dev.name, NFTOP_U_OUT_IFACE) == 0;
-                        }
-                    }
+            // the device table, the interface filters and sorting by interface need the interfaces of all of them
+            routes_first = NFTOP_FLAGS_DEV_ONLY || NFTOP_U_IN_IFACE != NULL || NFTOP_U_OUT_IFACE != NULL
+                || NFTOP_U_SORT_FIELD == NFTOP_SORT_IN || NFTOP_U_SORT_FIELD == NFTOP_SORT_OUT;
+
+            if (routes_first) {
+                routed = candidates;
+                array_pos = route_connections(conns, display_list, candidates, ns_devices);
+                NFTOP_TX_ALL = NFTOP_RX_ALL = 0;
+                for (i = 0; i < array_pos; i++) {
+                    NFTOP_TX_ALL += conns->bps_tx[display_list[i]];
+                    NFTOP_RX_ALL += conns->bps_rx[display_list[i]];
+                }
+            } else {
+                array_pos = candidates;
+            }
 
-                    if ((curr_ct->net_in_dev.flags & IFF_LOOPBACK) && NFTOP_U_NO_LOOPBACK == 1) {
-                        match = false;
-                    }
+            // the rows displayed: the first in the sort order of those passing the interface filters; when the
+            // interfaces weren't looked up beforehand, the next best are taken in place of the loopback ones,
+            // as many as are still missing
+            rows = NFTOP_FLAGS_DEV_ONLY ? 0 : displayRows(NFTOP_DISPLAY_COUNT);
+            for (selected = 0; selected < rows && selected < array_pos; ) {
+                take = rows - selected < array_pos - selected ? rows - selected : array_pos - selected;
+                if (NFTOP_U_SORT_FIELD > 0)
+                    select_top(conns, display_list + selected, array_pos - selected, take);
+
+                if (routes_first) {
+                    selected += take;
+                    continue;
+                }
 
-                    if (NFTOP_U_DNS && (strlen(curr_ct->local.hostname_src) < 1 || strlen(curr_ct->local.hostname_dst) < 1)) {
-                        addr2host(curr_ct);
-                    }
+                // in the sort order, the rows alternate between namespaces; they are routed namespace by
+                // namespace, and those kept are put back in order (unsorted, they are grouped already)
+                sorted = NFTOP_U_SORT_FIELD > 0 && netnsCount() > 1;
+                if (sorted) {
+                    compare_conns = conns;
+                    qsort(display_list + selected, take, sizeof(uint32_t), compare_netns);
+                }
 
-                    if (match == true) {
-                        add_ct(&displayArray, curr_ct);
-                        array_pos++;
-                        NFTOP_TX_ALL += curr_ct->bps_tx;
-                        NFTOP_RX_ALL += curr_ct->bps_rx;
-                    }
+                routed += take;
+                kept = route_connections(conns, display_list + selected, take, ns_devices);
+                if (sorted)
+                    sortConnections(conns, display_list + selected, kept);
+                for (i = selected + kept; i < selected + take; i++) {
+                    NFTOP_TX_ALL -= conns->bps_tx[display_list[i]];
+                    NFTOP_RX_ALL -= conns->bps_rx[display_list[i]];
                 }
 
-                curr_ct = curr_ct->next;
+                // the connections not taken yet close the gap left by the filtered ones
+                memmove(display_list + selected + kept, display_list + selected + take, (array_pos - selected - take) * sizeof(uint32_t));
+                array_pos -= take - kept;
+                selected += kept;
+            }
+            array_pos = selected < rows ? selected : rows;
+
+            // service and host names of the rows displayed only; names are resolved from the namespace nftop runs in
+            netnsRestore();
+            hosts = (NFTOP_U_NUMERIC_SRC || NFTOP_U_REDACT_SRC ? 0 : NFTOP_RESOLVED_SRC) | (NFTOP_U_NUMERIC_DST || NFTOP_U_REDACT_DST ? 0 : NFTOP_RESOLVED_DST);
+            for (i = 0; i < array_pos; i++) {
+                curr_ct = display_list[i];
+                connectionServices(conns, curr_ct);
+
+                if (NFTOP_U_DNS && !NFTOP_FLAGS_SKIP_DNS && (conns->info[curr_ct]->resolved & hosts) != hosts) {
+                    now_cpu = process_cpu_ns();
+                    addr2host(conns, curr_ct);
+                    dns_cpu += process_cpu_ns() - now_cpu;
+                    resolved++;
+                }
             }
-        }
 
-        if (NFTOP_U_SORT_FIELD > 0 && NFTOP_FLAGS_DEV_ONLY == 0) {
-            sortConnections(&displayArray);
+            // how many flows reached each stage
+            DLOG(NFTOP_FLAGS_DEBUG, "stages: %d flows (%d carried over), %d passed the filters (%s), %d routed, %d displayed, %d resolved\n",
+                flows, carried, candidates, ratesKernel(), routed, array_pos, resolved);
+        }
+        netnsRestore();
+        stage_join = monotonic_ns();
+
+        // one device list across namespaces for the device table (and to be freed)
+        devices_list = NULL;
+        dev_tail = &devices_list;
+        for (ns = 0; ns < netnsCount(); ns++) {
+            *dev_tail = ns_devices[ns];
+            while (*dev_tail != NULL)
+                dev_tail = &(*dev_tail)->next;
         }
 
         // if IO is not being redirected (i.e. via grep, tee, etc.), display the header
@@ -1186,20 +1580,20 @@ int main(int argc, char **argv) {
         }
 
         if (!NFTOP_FLAGS_DEV_ONLY) {
-            display_head = displayArray;
-            while (display_head != NULL) {
-                if (display_head->id > 0) {
-                    displayCTInfo(display_head);
-                }
-                display_head = display_head->next;
-            }
+            for (i = 0; i < array_pos; i++)
+                displayCTInfo(conns, display_list[i]);
         } else {
             sortInterfaces(&devices_list);
             displayDevices(devices_list);
         }
 
-        if (history_head_ct != NULL) {
-            pause = wait_char(NFTOP_U_INTERVAL);
+        stage_display = monotonic_ns();
+        DLOG(NFTOP_FLAGS_DEBUG, "cycle: collect %.1fms, join/routes %.1fms (dns %.1fms cpu), display %.1fms; interval %gs\n",
+            (stage_collect - cycle_wall) / 1e6, (stage_join - stage_collect) / 1e6, dns_cpu / 1e6,
+            (stage_display - stage_join) / 1e6, NFTOP_INTERVAL);
+
+        if (primed) {
+            pause = wait_char(NFTOP_INTERVAL);
             if (pause == 1) {
                 NFTOP_FLAGS_PAUSE = 1;
                 pause = 0;
@@ -1208,26 +1602,20 @@ int main(int argc, char **argv) {
                 NFTOP_FLAGS_PAUSE = 1;
                 pause = 0;
                 if (!NFTOP_FLAGS_DEV_ONLY) {
-                    display_head = displayArray;
-                    while (display_head != NULL) {
-                        if (display_head->id > 0) {
-                            displayCTInfo(display_head);
-                        }
-                        display_head = display_head->next;
-                    }
+                    for (i = 0; i < array_pos; i++)
+                        displayCTInfo(conns, display_list[i]);
                 } else {
                     displayDevices(devices_list);
                 }
-                NFTOP_FLAGS_PAUSE = wait_char(NFTOP_U_INTERVAL);
+                NFTOP_FLAGS_PAUSE = wait_char(NFTOP_INTERVAL);
             } else {
                 NFTOP_FLAGS_PAUSE = pause;
             }
         }
 
-        freeConnectionTrackingList(history_head_ct);
-        freeConnectionTrackingList(displayArray);
-
-        history_head_ct = current_head_ct;
+        // counter-reset mode keeps no history; the dump alone carries the interval's bytes (as do the shards' samples)
+        historyIndex(&history_index, NFTOP_U_ZERO || NFTOP_U_SHARD_MASK ? NULL : conns);
+        primed = true;
 
         NFTOP_RX_ALL = 0;
         NFTOP_TX_ALL = 0;
@@ -1235,15 +1623,42 @@ int main(int argc, char **argv) {
 
         // clear out the display list(s)
         free_interfaces(&devices_list);
+
+#ifdef NFTOP_ALLOC_COUNT
+        // once the arenas, indexes and pools have grown to the table, a refresh allocates nothing
+        refreshes++;
+        DLOG(NFTOP_FLAGS_DEBUG, "allocations: %" PRIu64 "\n", allocCount() - alloc_count);
+        if (refreshes == 1 && allocCount() == 0) {
+            // the first refresh grows the arenas: without --wrap, nothing is counted and nothing checked
+            fprintf(stderr, "no heap allocations counted; link with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc\n");
+            exit(EXIT_FAILURE);
+        }
+        if (refreshes > NFTOP_ALLOC_WARMUP && allocCount() != alloc_count) {
+            fprintf(stderr, "refresh %d made %" PRIu64 " heap allocations\n", refreshes, allocCount() - alloc_count);
+            exit(EXIT_FAILURE);
+        }
+        if (refreshes == NFTOP_ALLOC_REFRESHES)
+            NFTOP_FLAGS_EXIT = 1;
+        alloc_count = allocCount();
+#endif
     }
 
-    if (current_head_ct != NULL)
-        freeConnectionTrackingList(current_head_ct);
+    arenaFree();
+    ratesFree(&rates);
+    free(display_list);
 
-    if (curr_ct != NULL)
-        free(curr_ct);
+    if (NFTOP_U_EVENTS)
+        eventsClose();
+    closedClose();
+    closeNFCT();
+    routeClose();
+    historyFree(&history_index);
+    closeStats();
+    netnsClose();
 
     free_dns_cache();
+    free_device_pool();
+    internFree();
     displayClose();
 
     return 0;
@@ -0,0 +1,129 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <limits.h>
+#include <unistd.h>
+
+#ifndef __FILENAME__
+#   define __FILENAME__ "src/netns.c"
+#endif
+
+#include "nftop.h"
+#include "netns.h"
+#include "util.h"
+
+/*
+ * network namespaces collected from (-X); sockets are bound to the namespace they are
+ * created in, so a thread only enters a namespace to create its handles and returns
+ */
+struct Netns {
+    char name[NFTOP_NETNS_NAMESIZ];
+    int fd;
+};
+
+static struct Netns netns_list[NFTOP_MAX_NETNS];
+static int netns_count = 0;
+static int netns_self = -1;     // namespace nftop was started in
+static _Thread_local int netns_current = -1;   // namespace the thread entered last, -1 for its own
+
+/* adds a namespace by `ip netns` name or by path (e.g. /proc/<pid>/ns/net) */
+int netnsAdd(const char *ns) {
+    char path[PATH_MAX];
+    const char *name;
+    struct Netns *entry;
+
+    if (netns_count == NFTOP_MAX_NETNS) {
+        fprintf(stderr, "at most %d network namespaces can be given\n", NFTOP_MAX_NETNS);
+        return -1;
+    }
+
+    if (netns_self == -1 && (netns_self = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC)) == -1) {
+        perror("/proc/self/ns/net");
+        return -1;
+    }
+
+    if (strchr(ns, '/') == NULL) {
+        snprintf(path, sizeof(path), "%s/%s", NFTOP_NETNS_RUN_DIR, ns);
+        name = ns;
+    } else {
+        snprintf(path, sizeof(path), "%s", ns);
+        name = strrchr(ns, '/') + 1;
+    }
+
+    entry = &netns_list[netns_count];
+    if ((entry->fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+
+    netns_count++;
+
+    return 0;
+}
+
+/* number of namespaces to collect from; the current namespace counts as one when none were given */
+int netnsCount() {
+    return netns_count ? netns_count : 1;
+}
+
+bool netnsConfigured() {
+    return netns_count > 0;
+}
+
+const char *netnsName(uint16_t ns) {
+    if (ns >= netns_count)
+        return "";
+    return netns_list[ns].name;
+}
+
+/* moves the calling thread into namespace ns; a no-op unless namespaces were given */
+int netnsEnter(uint16_t ns) {
+    if (ns >= netns_count)
+        return 0;
+
+    if (setns(netns_list[ns].fd, CLONE_NEWNET) == -1) {
+        DLOG(NFTOP_FLAGS_DEBUG, "setns(%s): %s\n", netns_list[ns].name, strerror(errno));
+        return -1;
+    }
+    netns_current = ns;
+
+    return 0;
+}
+
+/* namespace the thread is in: the index of an entered namespace, -1 for the one nftop was started in */
+int netnsCurrent() {
+    return netns_current;
+}
+
+/* moves the calling thread back into the namespace nftop was started in */
+void netnsRestore() {
+    if (netns_self != -1 && setns(netns_self, CLONE_NEWNET) == -1) {
+        perror("setns");
+        exit(EXIT_FAILURE);
+    }
+    netns_current = -1;
+}
+
+void netnsClose() {
+    int i;
+
+    for (i = 0; i < netns_count; i++)
+        close(netns_list[i].fd);
+    netns_count = 0;
+
+    if (netns_self != -1) {
+        close(netns_self);
+        netns_self = -1;
+    }
+}
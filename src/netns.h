@@ -0,0 +1,25 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_NETNS_H
+#define _NFTOP_NETNS_H
+
+#define NFTOP_MAX_NETNS         256                 // namespaces that can be given with -X
+#define NFTOP_NETNS_RUN_DIR     "/var/run/netns"    // where `ip netns` names are resolved
+#define NFTOP_NETNS_NAMESIZ     32
+
+int netnsAdd(const char *);
+int netnsCount();
+bool netnsConfigured();
+const char *netnsName(uint16_t);
+int netnsEnter(uint16_t);
+int netnsCurrent();
+void netnsRestore();
+void netnsClose();
+
+#endif
@@ -12,7 +12,10 @@
 
 #define VERSION "1.1.1"
 
-#include <libnetfilter_conntrack/libnetfilter_conntrack.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <net/if.h>    // IFNAMSIZ
 #include <linux/netfilter/nf_conntrack_tcp.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -31,6 +34,10 @@
 #define NSEC_PER_SEC 1000000000L
 #endif
 
+#define NFTOP_MIN_INTERVAL 0.05    // shortest update interval in seconds (one tick of wait_char)
+#define NFTOP_BUDGET_MAX_STRETCH 16 // --cpu-budget may stretch the interval up to this multiple of -u
+#define NFTOP_BUDGET_DNS_PROBE 10   // intervals between attempts to resume host name lookups suspended by --cpu-budget
+
 #ifndef USEC_PER_SEC
 #define USEC_PER_SEC 1000000
 #endif
@@ -62,7 +69,7 @@ enum nftop_sort_fields {
 };
 
 // User options
-extern int     NFTOP_U_INTERVAL;
+extern double  NFTOP_U_INTERVAL;
 extern int     NFTOP_U_DISPLAY_AGE;
 extern int     NFTOP_U_SI;
 extern int     NFTOP_U_BYTES;
@@ -87,6 +94,20 @@ extern int     NFTOP_U_NUMERIC_DST;
 extern int     NFTOP_U_NUMERIC_PORT;
 extern int     NFTOP_U_BPS;
 extern int     NFTOP_U_CONTINUOUS;
+extern int     NFTOP_U_EVENTS;
+extern int     NFTOP_U_EVENT_RESYNC;
+extern int     NFTOP_U_NFCT_PARSE;
+extern uint32_t NFTOP_U_MARK;
+extern uint32_t NFTOP_U_MARK_MASK;
+extern int     NFTOP_U_ZONE;
+extern int     NFTOP_U_RCVBUF;
+extern int     NFTOP_U_ZERO;
+extern int     NFTOP_U_CLOSED;
+extern int     NFTOP_U_NETNS_VIEW;
+extern uint32_t NFTOP_U_SHARD_MASK;
+extern double  NFTOP_U_CPU_BUDGET;
+extern char*   NFTOP_U_WATCH;
+extern char*   NFTOP_U_PROC_FILE;
 
 // Runtime flags
 extern int     NFTOP_FLAGS_TIMESTAMP; // runtime flag to indicate if nf_conntrack_timestamp was detected
@@ -97,11 +118,23 @@ extern int     NFTOP_FLAGS_PAUSE;
 extern int     NFTOP_FLAGS_DEV_ONLY;
 extern int     NFTOP_FLAGS_COLUMNS;
 extern int     NFTOP_FLAGS_DEBUG;
+extern int     NFTOP_FLAGS_SKIP_DNS;
 
 // Global counters/objects
 extern uint64_t NFTOP_RX_ALL;
 extern uint64_t NFTOP_TX_ALL;
 extern int NFTOP_CT_COUNT;
+extern uint64_t NFTOP_DUMP_SYSCALLS;
+extern uint64_t NFTOP_DUMP_BYTES;
+extern int     NFTOP_DUMP_RETRIES;
+extern int     NFTOP_DUMP_PARTIAL;
+extern int     NFTOP_DUMP_SHARD;
+extern int     NFTOP_DUMP_SHARDS;
+extern struct ConntrackStats NFTOP_CT_STATS;
+extern uint64_t NFTOP_DUMP_ELAPSED;
+extern double  NFTOP_INTERVAL;
+extern uint64_t NFTOP_CYCLE_CPU;
+extern double  NFTOP_CYCLE_LOAD;
 extern int NFTOP_CT_ITER;
 extern int NFTOP_DNS_ITER;
 extern size_t NFTOP_MAX_HOSTNAME;
@@ -117,23 +150,12 @@ extern WINDOW *w;
 extern struct winsize w;
 #endif
 
-struct Network {
-    char src[INET6_ADDRSTRLEN];
-    uint16_t sport;
-    char sport_str[NI_MAXSERV];
-    char dst[INET6_ADDRSTRLEN];
-    uint16_t dport;
-    char dport_str[NI_MAXSERV];
-    char hostname_src[NI_MAXHOST];
-    char hostname_dst[NI_MAXHOST];
-    struct sockaddr_storage src_ip;
-    struct sockaddr_storage dst_ip;
-};
-
 struct Interface {
     char name[IFNAMSIZ];
+    uint32_t name_id;       // name as interned by internString()
     int flags;
     int n_addresses;
+    uint16_t netns;         // index of the namespace the interface belongs to (-X)
     int64_t bps_rx;
     int64_t bps_tx;
     int64_t bps_sum;
@@ -141,34 +163,136 @@ struct Interface {
     struct Interface *next;
 };
 
-struct Connection {
-	uint32_t id;
-    struct Interface net_in_dev;
-    struct Interface net_out_dev;
-    char *status_str;
-	uint64_t bytes_orig;
-	uint64_t bytes_repl;
-    uint64_t bytes_sum;
-    int64_t bps_rx;
-    int64_t bps_tx;
-    int64_t bps_sum;
-	time_t delta;
-    time_t time_start;
-	uint8_t proto_l3;
-	uint8_t proto_l4;
-	struct Network local;
-	struct Network remote;
-	uint32_t status;
-    uint32_t status_l4;
-    bool is_src_nat;
-    bool is_dst_nat;
+/* compact record of a conntrack entry, as collected from ctnetlink */
+struct Flow {
+    uint32_t id;
+    uint32_t status;
     uint32_t mark;
-    struct Connection *next;
+    uint16_t zone;
+    uint8_t proto_l3;
+    uint8_t proto_l4;
+    uint8_t status_l4;
+    uint16_t orig_sport;    // raw l4 src/dst (network byte order); ICMP id and type/code for ICMP
+    uint16_t orig_dport;
+    uint16_t repl_sport;
+    uint16_t repl_dport;
+    uint16_t netns;         // index of the namespace the flow was collected from (-X)
+    uint64_t time_start;    // nanoseconds, 0 if nf_conntrack_timestamp is disabled
+    uint64_t time_stop;
+    uint64_t bytes_orig;
+    uint64_t bytes_repl;
+    uint64_t time_seen;     // CLOCK_MONOTONIC nanoseconds at which the counters were read
+    struct in6_addr orig_src; // IPv4 addresses occupy the first 4 bytes
+    struct in6_addr orig_dst;
+    struct in6_addr repl_src;
+    struct in6_addr repl_dst;
+};
+
+/* a poll of the watched flow (-W) */
+struct WatchSample {
+    int64_t bps_orig;   // rates since the previous poll, in the original and reply directions
+    int64_t bps_repl;
+};
+
+/* conntrack table statistics (ctnetlink GET_STATS / GET_STATS_CPU), summed over namespaces */
+struct ConntrackStats {
+    bool valid;                 // the kernel answered the stats queries of the last interval
+    uint32_t entries;
+    uint32_t max_entries;       // nf_conntrack_max, one limit for all namespaces; 0 on kernels that don't report it
+    uint64_t insert_failed;     // totals since boot, summed over all CPUs (and namespaces)
+    uint64_t drop;
+    uint64_t early_drop;
+    uint64_t insert_failed_delta;   // increase since the previous interval
+    uint64_t drop_delta;
+    uint64_t early_drop_delta;
+};
+
+// lookups made for the presentation data of a connection (ConnectionInfo.resolved)
+#define NFTOP_RESOLVED_SERVICES 0x1
+#define NFTOP_RESOLVED_SRC      0x2
+#define NFTOP_RESOLVED_DST      0x4
+
+/*
+ * presentation data of a connection, filled in only for the connections that may be displayed; the
+ * names are handles of internString(), 0 (the empty string) until they are looked up. It is copied
+ * to the next generation of the flow, so each lookup is made once for the life of the flow; the
+ * interfaces only as long as routeEpoch() says no route, address or link changed.
+ */
+struct ConnectionInfo {
+    uint32_t net_in_dev;    // interface names, "*" without a route
+    uint32_t net_out_dev;
+    int net_in_flags;       // flags of net_in_dev (IFF_LOOPBACK)
+    uint32_t route_epoch;   // routeEpoch() of the namespace when the interfaces were found; 0 before
+    uint32_t sport_str;     // service names of the ports
+    uint32_t dport_str;
+    uint32_t hostname_src;
+    uint32_t hostname_dst;
+    uint8_t resolved;       // NFTOP_RESOLVED_*
+    char *status_str;
+};
+
+// flags of a connection (Connections.flags)
+#define NFTOP_CT_SRC_NAT    0x1
+#define NFTOP_CT_DST_NAT    0x2
+#define NFTOP_CT_CLOSED     0x4     // destroyed during the interval; bytes are the final counters
+#define NFTOP_CT_SAMPLE     0x8     // samples holds the bytes since the flow's previous observation
+
+/* raw addresses of a connection (as used in RTA_SRC/RTA_DST), IPv4 in the first 4 bytes */
+struct ConnectionAddresses {
+    struct in6_addr orig_src;
+    struct in6_addr orig_dst;
+    struct in6_addr repl_src;
+    struct in6_addr repl_dst;
+};
+
+/* bytes since the flow's previous observation, for collectors that keep flows across queries (sharded dumps) */
+struct ConnectionSample {
+    uint64_t orig;
+    uint64_t repl;
+    uint64_t ns;
+};
+
+/*
+ * the conntrack entries of a generation as joined, filtered and sorted every interval, one column
+ * per field; a connection is its index in them. The join and the filters read the first two groups
+ * of columns of every connection, the others are only read for the candidates of the threshold,
+ * and the names describing a connection are in info. Only the first group is kept for the next
+ * generation (see arenaSwap()). Addresses are kept raw and only formatted for the rows displayed.
+ */
+struct Connections {
+    size_t count;
+    // kept for the next generation, which computes its rates against them and carries info over
+    uint32_t *id;
+    time_t *time_start;
+    uint64_t *bytes_orig;
+    uint64_t *bytes_repl;
+    uint64_t *time_seen;            // CLOCK_MONOTONIC nanoseconds at which the counters were read
+    struct ConnectionInfo **info;   // NULL until the connection is enriched
+    size_t size_kept;
+    // read for every connection
+    uint8_t *proto_l3;
+    uint16_t *netns;                // index of the namespace the connection was collected from (-X)
+    time_t *delta;
+    uint8_t *flags;                 // NFTOP_CT_*
+    // read for the candidates
+    int64_t *bps_rx;
+    int64_t *bps_tx;
+    int64_t *bps_sum;
+    uint8_t *proto_l4;
+    uint8_t *status_l4;
+    uint32_t *status;
+    uint32_t *mark;
+    uint16_t *sport;                // local source port, the (post-NAT) reply destination port; 0 for ICMP
+    uint16_t *dport;
+    struct ConnectionAddresses *addrs;
+    struct ConnectionSample *samples;   // NULL until a connection has one
+    size_t size;
 };
 
 int is_redirected();
 void interactiveHelp();
 int compare(const void *, const void *);
+int compare_connections(const void *, const void *);
 int compare_addresses(const void *, const void *);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,306 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <linux/netfilter/nf_conntrack_common.h>
+
+#include "nftop.h"
+#include "proc.h"
+
+/*
+ * The /proc/net/nf_conntrack collector (-f) needs neither libnetfilter_conntrack nor libmnl: this
+ * file only depends on the kernel's headers, and is built on its own by the proc_parse test.
+ */
+
+/* a whitespace separated field of a /proc/net/nf_conntrack line */
+struct ProcToken {
+    const char *s;
+    size_t len;
+};
+
+static int add_token(struct ProcToken *tokens, int n, int max, const char *line, size_t start, size_t stop) {
+    // runs of spaces (the columns are padded) produce no token
+    if (stop > start && n < max) {
+        tokens[n].s = line + start;
+        tokens[n].len = stop - start;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * splits a line at its spaces; with SSE2, 16 bytes are compared at once and the token boundaries are
+ * taken from the bits of the resulting mask, so the bytes inside tokens are never looked at one by one
+ */
+static int tokenize(const char *line, size_t len, struct ProcToken *tokens, int max) {
+    size_t i = 0, start = 0, pos;
+    int n = 0;
+
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    unsigned int mask;
+
+    for (; i + 16 <= len; i += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(line + i)), space));
+        while (mask != 0) {
+            pos = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+            n = add_token(tokens, n, max, line, start, pos);
+            start = pos + 1;
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (line[i] == ' ') {
+            n = add_token(tokens, n, max, line, start, i);
+            start = i + 1;
+        }
+    }
+
+    return add_token(tokens, n, max, line, start, len);
+}
+
+/* decimal value of s; returns -1 on any other character */
+static int parse_decimal(const char *s, size_t len, uint64_t *value) {
+    size_t i;
+
+    if (len == 0)
+        return -1;
+
+    *value = 0;
+    for (i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        *value = *value * 10 + (s[i] - '0');
+    }
+
+    return 0;
+}
+
+static int parse_address(const char *s, size_t len, uint8_t family, struct in6_addr *addr) {
+    char buf[INET6_ADDRSTRLEN];
+
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+
+    return inet_pton(family, buf, addr) == 1 ? 0 : -1;
+}
+
+/* the TCP_CONNTRACK_* state of the name printed by the kernel */
+static uint8_t tcp_state(const char *s, size_t len) {
+    static const char *names[] = {
+        "NONE", "SYN_SENT", "SYN_RECV", "ESTABLISHED", "FIN_WAIT", "CLOSE_WAIT", "LAST_ACK", "TIME_WAIT", "CLOSE", "SYN_SENT2"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) == len && memcmp(names[i], s, len) == 0)
+            return i;
+    }
+
+    return 0;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+    const uint8_t *p = data;
+
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+
+    return hash;
+}
+
+#define KEY_IS(t, key) ((t)->len > sizeof(key) - 1 && memcmp((t)->s, key, sizeof(key) - 1) == 0)
+
+/*
+ * parses a line of /proc/net/nf_conntrack (without its newline) into a flow record, as nlmsg2flow()
+ * does for a ctnetlink message:
+ *   ipv4     2 tcp      6 431999 ESTABLISHED src=10.0.0.2 dst=192.0.2.1 sport=51234 dport=443 packets=10 bytes=1200
+ *            src=192.0.2.1 dst=10.0.0.2 sport=443 dport=51234 packets=8 bytes=5000 [ASSURED] mark=0 zone=0 use=2
+ * the file carries no conntrack ID; the ID is a hash of the original tuple, and the status bits nftop
+ * uses are derived from the flags and the tuples. returns -1 if the line is not a conntrack entry.
+ */
+int procline2flow(const char *line, size_t len, struct Flow *flow) {
+    struct ProcToken tokens[NFTOP_PROC_TOKENS], *t;
+    const char *value;
+    size_t value_len;
+    uint64_t number;
+    uint32_t hash = 2166136261u;
+    int n, i, dir = -1, seen_reply = 1, icmp;
+    uint8_t type = 0, code = 0;
+
+    n = tokenize(line, len, tokens, NFTOP_PROC_TOKENS);
+    if (n < 5)
+        return -1;
+
+    memset(flow, 0, sizeof(struct Flow));
+
+    if (parse_decimal(tokens[1].s, tokens[1].len, &number) == -1 || (number != AF_INET && number != AF_INET6))
+        return -1;
+    flow->proto_l3 = number;
+
+    if (parse_decimal(tokens[3].s, tokens[3].len, &number) == -1 || number > 255)
+        return -1;
+    flow->proto_l4 = number;
+
+    // tokens[4] is the timeout; TCP entries are followed by their state
+    i = 5;
+    if (flow->proto_l4 == IPPROTO_TCP && n > 5 && memchr(tokens[5].s, '=', tokens[5].len) == NULL) {
+        flow->status_l4 = tcp_state(tokens[5].s, tokens[5].len);
+        i++;
+    }
+
+    for (; i < n; i++) {
+        t = &tokens[i];
+
+        if (t->s[0] == '[') {
+            if (t->len == 11 && memcmp(t->s, "[UNREPLIED]", 11) == 0)
+                seen_reply = 0;
+            else if (t->len == 9 && memcmp(t->s, "[ASSURED]", 9) == 0)
+                flow->status |= IPS_ASSURED;
+            continue;
+        }
+
+        if ((value = memchr(t->s, '=', t->len)) == NULL)
+            continue;
+        value++;
+        value_len = t->len - (value - t->s);
+
+        // the original tuple and counters come first, then those of the reply direction
+        if (KEY_IS(t, "src=")) {
+            if (++dir > 1 || parse_address(value, value_len, flow->proto_l3, dir ? &flow->repl_src : &flow->orig_src) == -1)
+                return -1;
+        } else if (dir < 0) {
+            continue;
+        } else if (KEY_IS(t, "dst=")) {
+            if (parse_address(value, value_len, flow->proto_l3, dir ? &flow->repl_dst : &flow->orig_dst) == -1)
+                return -1;
+        } else if (parse_decimal(value, value_len, &number) == -1) {
+            continue;   // secctx=, labels=, helper=, ...
+        } else if (KEY_IS(t, "sport=")) {
+            *(dir ? &flow->repl_sport : &flow->orig_sport) = htons(number);
+        } else if (KEY_IS(t, "dport=")) {
+            *(dir ? &flow->repl_dport : &flow->orig_dport) = htons(number);
+        } else if (KEY_IS(t, "bytes=")) {
+            *(dir ? &flow->bytes_repl : &flow->bytes_orig) = number;
+        } else if (KEY_IS(t, "type=") && dir == 0) {
+            type = number;
+        } else if (KEY_IS(t, "code=") && dir == 0) {
+            code = number;
+        } else if (KEY_IS(t, "id=") && dir == 0) {
+            flow->orig_sport = htons(number);
+        } else if (KEY_IS(t, "mark=")) {
+            flow->mark = number;
+        } else if (KEY_IS(t, "zone=")) {
+            flow->zone = number;
+        }
+    }
+
+    if (dir != 1)
+        return -1;
+
+    icmp = flow->proto_l4 == IPPROTO_ICMP || flow->proto_l4 == IPPROTO_ICMPV6;
+
+    // as ct2flow(): ICMP keeps the ID in orig_sport and type/code in orig_dport
+    if (icmp)
+        flow->orig_dport = (type << 8) | code;
+
+    // only confirmed entries are listed; a reply tuple differing from the inverted original one means NAT
+    flow->status |= IPS_CONFIRMED | (seen_reply ? IPS_SEEN_REPLY : 0);
+    if (memcmp(&flow->repl_dst, &flow->orig_src, sizeof(struct in6_addr)) != 0 || (!icmp && flow->repl_dport != flow->orig_sport))
+        flow->status |= IPS_SRC_NAT;
+    if (memcmp(&flow->repl_src, &flow->orig_dst, sizeof(struct in6_addr)) != 0 || (!icmp && flow->repl_sport != flow->orig_dport))
+        flow->status |= IPS_DST_NAT;
+
+    // FNV-1a of the original tuple: stable for the lifetime of the entry, like the conntrack ID
+    hash = fnv1a(hash, &flow->orig_src, sizeof(struct in6_addr));
+    hash = fnv1a(hash, &flow->orig_dst, sizeof(struct in6_addr));
+    hash = fnv1a(hash, &flow->orig_sport, sizeof(flow->orig_sport));
+    hash = fnv1a(hash, &flow->orig_dport, sizeof(flow->orig_dport));
+    hash = fnv1a(hash, &flow->proto_l4, sizeof(flow->proto_l4));
+    hash = fnv1a(hash, &flow->zone, sizeof(flow->zone));
+    flow->id = hash ? hash : 1;
+
+    return 0;
+}
+
+/* CLOCK_MONOTONIC in nanoseconds, as monotonic_ns() gives it */
+static uint64_t proc_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* parses the complete lines of len bytes of buf; returns the bytes of the trailing partial line */
+static size_t proc_lines(struct ProcReader *r, const char *buf, size_t len, uint64_t now) {
+    const char *line = buf, *nl;
+    struct Flow flow;
+
+    while ((nl = memchr(line, '\n', buf + len - line)) != NULL) {
+        if (procline2flow(line, nl - line, &flow) == 0) {
+            flow.time_seen = now;
+            r->flow_cb(&flow, r->data);
+        }
+        line = nl + 1;
+    }
+
+    return buf + len - line;
+}
+
+/*
+ * reads fd to its end through the reader's buffer and passes its entries to flow_cb; a line split
+ * between two reads is carried over to the next one. returns -1 with errno if a read fails
+ */
+int procRead(struct ProcReader *r, int fd) {
+    size_t have = 0, total;
+    ssize_t len;
+
+    r->syscalls = 0;
+    r->bytes = 0;
+
+    for (;;) {
+        r->syscalls++;
+        len = read(fd, r->buf + have, r->size - have);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1)
+            return -1;
+        if (len == 0)
+            break;
+        r->bytes += len;
+        total = have + len;
+
+        have = proc_lines(r, r->buf, total, proc_now());
+        // a line filling the whole buffer is no conntrack entry; it is dropped
+        if (have == r->size)
+            have = 0;
+        memmove(r->buf, r->buf + total - have, have);
+    }
+
+    // a last line without its newline
+    if (have > 0) {
+        r->buf[have++] = '\n';
+        proc_lines(r, r->buf, have, proc_now());
+    }
+
+    return 0;
+}
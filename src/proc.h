@@ -0,0 +1,28 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_PROC_H
+#define _NFTOP_PROC_H
+
+#define NFTOP_PROC_TOKENS       48          // fields of a /proc/net/nf_conntrack line looked at by procline2flow()
+#define NFTOP_PROC_BUFSIZ       (256 << 10) // read buffer of the /proc/net/nf_conntrack collector (-f)
+
+/* a file in the format of /proc/net/nf_conntrack, streamed through a fixed buffer by procRead() */
+struct ProcReader {
+    char *buf;
+    size_t size;            // of buf; a line that doesn't fit is dropped
+    void (*flow_cb)(struct Flow *, void *);     // called with every entry parsed, and data
+    void *data;
+    uint64_t syscalls;      // read() calls and bytes of the last procRead()
+    uint64_t bytes;
+};
+
+int procline2flow(const char *, size_t, struct Flow *);
+int procRead(struct ProcReader *, int);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "nftop.h"
+#include "rates.h"
+
+/*
+ * The rate of a flow is bytes * 8 * (NSEC_PER_SEC / elapsed), in doubles, as set_rates() always
+ * computed it; a flow is selected when it is eligible and the sum of its two rates, truncated to
+ * integers, reaches the threshold. The vector kernels do the same operations in the same order, so
+ * they select exactly the flows the scalar loop does. Rates are below NFTOP_RATE_MAX (2^52) for any
+ * flow that is selected, which keeps the truncated sums exact in doubles.
+ */
+
+/* grows the columns to hold at least n flows */
+void ratesReserve(struct RateColumns *r, size_t n) {
+    size_t size = r->size ? r->size : 1024;
+
+    if (n <= r->size)
+        return;
+    while (size < n)
+        size *= 2;
+
+    if (!(r->bytes_orig = realloc(r->bytes_orig, size * sizeof(uint64_t)))
+        || !(r->bytes_repl = realloc(r->bytes_repl, size * sizeof(uint64_t)))
+        || !(r->elapsed = realloc(r->elapsed, size * sizeof(uint64_t)))
+        || !(r->eligible = realloc(r->eligible, size * sizeof(uint8_t)))
+        || !(r->bps_orig = realloc(r->bps_orig, size * sizeof(double)))
+        || !(r->bps_repl = realloc(r->bps_repl, size * sizeof(double)))
+        || !(r->selected = realloc(r->selected, size * sizeof(uint32_t)))) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    r->size = size;
+}
+
+/* flows i to count, appended to the n already selected */
+static size_t select_scalar(struct RateColumns *r, size_t i, size_t n, int64_t thresh) {
+    double per_sec;
+
+    for (; i < r->count; i++) {
+        per_sec = (double)NSEC_PER_SEC / r->elapsed[i];
+        r->bps_orig[i] = r->bytes_orig[i] * 8 * per_sec;
+        r->bps_repl[i] = r->bytes_repl[i] * 8 * per_sec;
+
+        if (r->eligible[i] && r->bps_orig[i] < NFTOP_RATE_MAX && r->bps_repl[i] < NFTOP_RATE_MAX
+            && (int64_t)r->bps_orig[i] + (int64_t)r->bps_repl[i] >= thresh)
+            r->selected[n++] = i;
+    }
+
+    return n;
+}
+
+/* one bit per flow from the eligible column, as the movemask of the rates' comparisons has them */
+static inline unsigned int eligible_bits(const uint8_t *eligible, int lanes) {
+    unsigned int bits = 0;
+    int i;
+
+    for (i = 0; i < lanes; i++)
+        bits |= (eligible[i] != 0) << i;
+
+    return bits;
+}
+
+/* appends the flows of the set bits of mask, the lowest first */
+static inline size_t select_bits(struct RateColumns *r, size_t i, size_t n, unsigned int mask) {
+    while (mask != 0) {
+        r->selected[n++] = i + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+
+    return n;
+}
+
+#if defined(__AVX2__)
+
+/*
+ * unsigned 64-bit lanes to doubles, which AVX2 has no instruction for: the high and low halves are
+ * placed in the mantissas of 2^84 and 2^52, which are subtracted again; the only rounding is in the
+ * final addition, so the result is that of a scalar conversion
+ */
+static inline __m256d u64_pd(__m256i v) {
+    __m256i lo = _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi64x(0xffffffff)), _mm256_castpd_si256(_mm256_set1_pd(0x1p52)));
+    __m256i hi = _mm256_or_si256(_mm256_srli_epi64(v, 32), _mm256_castpd_si256(_mm256_set1_pd(0x1p84)));
+
+    return _mm256_add_pd(_mm256_sub_pd(_mm256_castsi256_pd(hi), _mm256_set1_pd(0x1p84 + 0x1p52)), _mm256_castsi256_pd(lo));
+}
+
+/* bytes * 8 * (NSEC_PER_SEC / elapsed), 4 flows at a time */
+size_t ratesSelect(struct RateColumns *r, int64_t thresh) {
+    const __m256d nsec = _mm256_set1_pd((double)NSEC_PER_SEC), max = _mm256_set1_pd(NFTOP_RATE_MAX);
+    const __m256d threshold = _mm256_set1_pd((double)thresh);
+    __m256d per_sec, orig, repl, sum, ok;
+    size_t i = 0, n = 0;
+
+    for (; i + 4 <= r->count; i += 4) {
+        per_sec = _mm256_div_pd(nsec, u64_pd(_mm256_loadu_si256((const __m256i *)(r->elapsed + i))));
+        orig = _mm256_mul_pd(u64_pd(_mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)(r->bytes_orig + i)), 3)), per_sec);
+        repl = _mm256_mul_pd(u64_pd(_mm256_slli_epi64(_mm256_loadu_si256((const __m256i *)(r->bytes_repl + i)), 3)), per_sec);
+        _mm256_storeu_pd(r->bps_orig + i, orig);
+        _mm256_storeu_pd(r->bps_repl + i, repl);
+
+        sum = _mm256_add_pd(_mm256_round_pd(orig, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC),
+            _mm256_round_pd(repl, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+        ok = _mm256_and_pd(_mm256_cmp_pd(orig, max, _CMP_LT_OQ), _mm256_cmp_pd(repl, max, _CMP_LT_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(sum, threshold, _CMP_GE_OQ));
+
+        n = select_bits(r, i, n, _mm256_movemask_pd(ok) & eligible_bits(r->eligible + i, 4));
+    }
+
+    return select_scalar(r, i, n, thresh);
+}
+
+const char *ratesKernel() {
+    return "avx2";
+}
+
+#elif defined(__SSE2__)
+
+/* unsigned 64-bit lanes to doubles, as the AVX2 kernel converts them */
+static inline __m128d u64_pd(__m128i v) {
+    __m128i lo = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi64x(0xffffffff)), _mm_castpd_si128(_mm_set1_pd(0x1p52)));
+    __m128i hi = _mm_or_si128(_mm_srli_epi64(v, 32), _mm_castpd_si128(_mm_set1_pd(0x1p84)));
+
+    return _mm_add_pd(_mm_sub_pd(_mm_castsi128_pd(hi), _mm_set1_pd(0x1p84 + 0x1p52)), _mm_castsi128_pd(lo));
+}
+
+/* truncation of rates: without SSE4.1, lanes from 0 to 2^52 are rounded by adding 2^52, less one where that rounded up */
+static inline __m128d trunc_pd(__m128d x) {
+#ifdef __SSE4_1__
+    return _mm_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+#else
+    const __m128d magic = _mm_set1_pd(0x1p52);
+    __m128d rounded = _mm_sub_pd(_mm_add_pd(x, magic), magic);
+
+    return _mm_sub_pd(rounded, _mm_and_pd(_mm_cmpgt_pd(rounded, x), _mm_set1_pd(1.0)));
+#endif
+}
+
+/* bytes * 8 * (NSEC_PER_SEC / elapsed), 2 flows at a time */
+size_t ratesSelect(struct RateColumns *r, int64_t thresh) {
+    const __m128d nsec = _mm_set1_pd((double)NSEC_PER_SEC), max = _mm_set1_pd(NFTOP_RATE_MAX);
+    const __m128d threshold = _mm_set1_pd((double)thresh);
+    __m128d per_sec, orig, repl, ok;
+    size_t i = 0, n = 0;
+
+    for (; i + 2 <= r->count; i += 2) {
+        per_sec = _mm_div_pd(nsec, u64_pd(_mm_loadu_si128((const __m128i *)(r->elapsed + i))));
+        orig = _mm_mul_pd(u64_pd(_mm_slli_epi64(_mm_loadu_si128((const __m128i *)(r->bytes_orig + i)), 3)), per_sec);
+        repl = _mm_mul_pd(u64_pd(_mm_slli_epi64(_mm_loadu_si128((const __m128i *)(r->bytes_repl + i)), 3)), per_sec);
+        _mm_storeu_pd(r->bps_orig + i, orig);
+        _mm_storeu_pd(r->bps_repl + i, repl);
+
+        // lanes at or above the maximum are rejected first: the truncation is only exact below it
+        ok = _mm_and_pd(_mm_cmplt_pd(orig, max), _mm_cmplt_pd(repl, max));
+        ok = _mm_and_pd(ok, _mm_cmpge_pd(_mm_add_pd(trunc_pd(orig), trunc_pd(repl)), threshold));
+
+        n = select_bits(r, i, n, _mm_movemask_pd(ok) & eligible_bits(r->eligible + i, 2));
+    }
+
+    return select_scalar(r, i, n, thresh);
+}
+
+const char *ratesKernel() {
+#ifdef __SSE4_1__
+    return "sse4.1";
+#else
+    return "sse2";
+#endif
+}
+
+#else
+
+size_t ratesSelect(struct RateColumns *r, int64_t thresh) {
+    return select_scalar(r, 0, 0, thresh);
+}
+
+const char *ratesKernel() {
+    return "scalar";
+}
+
+#endif
+
+/* the reference the kernels are checked against */
+size_t ratesSelectScalar(struct RateColumns *r, int64_t thresh) {
+    return select_scalar(r, 0, 0, thresh);
+}
+
+void ratesFree(struct RateColumns *r) {
+    free(r->bytes_orig);
+    free(r->bytes_repl);
+    free(r->elapsed);
+    free(r->eligible);
+    free(r->bps_orig);
+    free(r->bps_repl);
+    free(r->selected);
+    memset(r, 0, sizeof(*r));
+}
@@ -0,0 +1,33 @@
+/*
+ * (C) 2020-2023 by Kyle Huff <code@curetheitch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _NFTOP_RATES_H
+#define _NFTOP_RATES_H
+
+#define NFTOP_RATE_MAX  0x1p52  // bits per second; higher rates come from counters that went backwards
+
+/* the counters of a generation as columns, one entry per flow, and the rates computed from them */
+struct RateColumns {
+    uint64_t *bytes_orig;   // bytes counted in the original and reply directions
+    uint64_t *bytes_repl;
+    uint64_t *elapsed;      // nanoseconds they were counted over; never 0
+    uint8_t *eligible;      // 1 if the flow passes the filters that need no rate (family, namespace, age)
+    double *bps_orig;       // filled by ratesSelect()
+    double *bps_repl;
+    uint32_t *selected;     // indexes of the eligible flows whose rate reaches the threshold, in order
+    size_t count;
+    size_t size;
+};
+
+void ratesReserve(struct RateColumns *, size_t);
+size_t ratesSelect(struct RateColumns *, int64_t);
+size_t ratesSelectScalar(struct RateColumns *, int64_t);
+const char *ratesKernel();
+void ratesFree(struct RateColumns *);
+
+#endif
@@ -9,7 +9,9 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <string.h>
+#include <errno.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <arpa/inet.h>
@@ -21,11 +23,14 @@
 #endif
 
 #include "nftop.h"
+#include "netns.h"
 #include "util.h"
+#include "intern.h"
 
 #include <termios.h>
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 
 #define ROUTESIZE 8192
 
@@ -50,16 +55,6 @@ void set_conio_terminal_mode()
     tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
 }
 
-void freeConnectionTrackingList(struct Connection *head) {
-    struct Connection *temp;
-
-    while (head != NULL) {
-        temp = head;
-        head = temp->next;
-        free(temp);
-    }
-}
-
 void freeDeviceList(struct Interface* device_list_head) {
     struct Interface* temp;
 
@@ -77,21 +72,17 @@ void freeDeviceList(struct Interface* device_list_head) {
     }
 }
 
-char *formatUOM(uint64_t value) {
-    /* Format the Unit of Measure */
+/* formats value with its unit of measure into buf (NFTOP_UOM_LEN bytes will do), which is returned */
+char *formatUOM(uint64_t value, char *buf, size_t len) {
     double n_val = 0, factor;
-	int slen = 0;
-    char *suffix = '\0';
-    char *format = "%.1f %s";
+    char *format = "%.1f %c%s";
 
 	char suffix_unit1 = ' '; 	// {'',K,M,G,T,E}
 	char *suffix_unit2 = '\0'; 	    // bps, Bps, ibps or iBps
 
     if (NFTOP_U_BPS) {
-        slen = snprintf(NULL, 0, "%ld", value);
-        char *ret = malloc(slen + 1);
-        snprintf(ret, slen+1, "%ld", value);
-        return ret;
+        snprintf(buf, len, "%ld", value);
+        return buf;
     }
 
 	if (NFTOP_U_BYTES == 1) {
@@ -114,7 +105,7 @@ char *formatUOM(uint64_t value) {
 
 	if (value < (Kbps * factor)) {
 		n_val = value;
-		format = "%.0f %s";
+		format = "%.0f %c%s";
 		if (NFTOP_U_BYTES == 1) {
 			suffix_unit2 = "Bps";
 		} else {
@@ -134,28 +125,19 @@ char *formatUOM(uint64_t value) {
 		suffix_unit1 = 'T';
 	}
 
-	slen = snprintf(NULL, 0,   "%c%s", suffix_unit1, suffix_unit2);
-	suffix = malloc(slen + 1);
-	snprintf(suffix, slen + 1, "%c%s", suffix_unit1, suffix_unit2);
-
-    slen = snprintf(NULL, 0, format, n_val, suffix);
-    char *ret = malloc(slen + 2);
+    snprintf(buf, len, format, n_val, suffix_unit1, suffix_unit2);
 
-    snprintf(ret, slen + 2, format, n_val, suffix);
-
-	free(suffix);
-
-    return ret;
+    return buf;
 }
 
 char *getProtocolName(uint8_t proto) {
     return (proto == AF_INET) ? "IPv4" : "IPv6";
 }
 
-char *getIPProtocolName(uint8_t l3proto, uint8_t proto) {
-    char *proto_s, *proto_string;
-    int len = 1;
-    char version = (l3proto == AF_INET6) ? '6' : '\0';
+/* the name of L4 protocol proto, suffixed with 6 for IPv6, into buf (NFTOP_PROTO_LEN bytes), which is returned */
+char *getIPProtocolName(uint8_t l3proto, uint8_t proto, char *buf, size_t len) {
+    char *proto_s;
+    char *version = (l3proto == AF_INET6) ? "6" : "";
 
     switch(proto) {
         case IPPROTO_TCP:
@@ -182,16 +164,13 @@ char *getIPProtocolName(uint8_t l3proto, uint8_t proto) {
             proto_s = "vrrp";
             break;
         default:
-            len = snprintf(NULL, 0, "%u", proto) + 1;
-            proto_s = malloc(len+1);
-            snprintf(proto_s, len, "%d", proto);
+            snprintf(buf, len, "%u%s", proto, version);
+            return buf;
     }
 
-    len = snprintf(NULL, 0, "%s%c", proto_s, version) + 1;
-    proto_string = malloc(len+1);
-    snprintf(proto_string, len, "%s%c", proto_s, version);
+    snprintf(buf, len, "%s%s", proto_s, version);
 
-    return proto_string;
+    return buf;
 }
 
 char *getSortIndicator(int field) {
@@ -208,38 +187,20 @@ char *getSortIndicator(int field) {
 	return indicator;
 }
 
-void add_ct(struct Connection **head, struct Connection *curr_ct) {
-    struct Connection *new_ct = (struct Connection *)malloc(sizeof(struct Connection));
-    if (!new_ct) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
-    }
-
-    memcpy(new_ct, curr_ct, sizeof(struct Connection));
-    new_ct->next = NULL;  // Ensure the new node's next pointer is NULL
-
-    // If the list is empty, make the new node the head
-    if (*head == NULL) {
-        *head = new_ct;
-        return;
-    }
-
-    // Traverse the list to find the last node
-    struct Connection *current = *head;
-    while (current->next != NULL) {
-        current = current->next;
-    }
-
-    // Append the new node to the end of the list
-    current->next = new_ct;
-}
+// the devices and addresses of the previous intervals, reused by the next enumeration
+static struct Interface *interface_pool = NULL;
+static struct Address *address_pool = NULL;
 
 void add_address(struct Address **head, const char *ip, const char *nm, sa_family_t family) {
-    struct Address *new_address = (struct Address *)malloc(sizeof(struct Address));
-    if (!new_address) {
+    struct Address *new_address = address_pool;
+
+    if (new_address != NULL) {
+        address_pool = new_address->next;
+    } else if (!(new_address = (struct Address *)malloc(sizeof(struct Address)))) {
         perror("malloc");
         exit(EXIT_FAILURE);
     }
+    memset(new_address, 0, sizeof(struct Address));
     *new_address->ip = '\0';
     *new_address->netmask = '\0';
     strcpy(new_address->ip, ip);
@@ -258,13 +219,17 @@ void add_address(struct Address **head, const char *ip, const char *nm, sa_famil
 }
 
 void add_interface(struct Interface **head, const char *name) {
-    struct Interface *new_interface;
-    if (!(new_interface = (struct Interface *)malloc(sizeof(struct Interface)))) {
+    struct Interface *new_interface = interface_pool;
+
+    if (new_interface != NULL) {
+        interface_pool = new_interface->next;
+    } else if (!(new_interface = (struct Interface *)malloc(sizeof(struct Interface)))) {
         perror("malloc");
         exit(EXIT_FAILURE);
     }
     memset(new_interface, 0, sizeof(struct Interface));
     strncpy(new_interface->name, name, IFNAMSIZ-1);
+    new_interface->name_id = internString(new_interface->name);
     new_interface->bps_tx = 0;
     new_interface->bps_rx = 0;
     new_interface->bps_sum = 0;
@@ -274,18 +239,21 @@ void add_interface(struct Interface **head, const char *name) {
     *head = new_interface;
 }
 
+/* returns the addresses to the pool for the next enumeration */
 void free_addresses(struct Address **head) {
     struct Address *temp;
 
     while (*head != NULL) {
         temp = *head;
         *head = temp->next;
-        free(temp);
+        temp->next = address_pool;
+        address_pool = temp;
     }
 
     *head = NULL;
 }
 
+/* returns the interfaces and their addresses to the pool for the next enumeration */
 void free_interfaces(struct Interface **head) {
     struct Interface *temp;
     while (*head != NULL) {
@@ -293,12 +261,27 @@ void free_interfaces(struct Interface **head) {
         free_addresses(&temp->addresses);
         *head = temp->next;
 
-        free(temp);
+        temp->next = interface_pool;
+        interface_pool = temp;
     }
 
     *head = NULL;
 }
 
+void free_device_pool() {
+    struct Interface *interface;
+    struct Address *address;
+
+    while ((interface = interface_pool) != NULL) {
+        interface_pool = interface->next;
+        free(interface);
+    }
+    while ((address = address_pool) != NULL) {
+        address_pool = address->next;
+        free(address);
+    }
+}
+
 void enumerateNetworkDevices(struct Interface **interfaces) {
     struct ifaddrs *ifaddr, *ifa;
 
@@ -343,6 +326,8 @@ void enumerateNetworkDevices(struct Interface **interfaces) {
             interface->n_addresses += 1;
             memcpy(&(interface->addresses)->s_addr, (struct sockaddr_storage *)(ifa->ifa_addr), sizeof(struct sockaddr_storage));
             memcpy(&(interface->addresses)->s_mask, (struct sockaddr_storage *)(ifa->ifa_netmask), sizeof(struct sockaddr_storage));
+            memset(&(interface->addresses)->raw, 0, sizeof(struct in6_addr));
+            memcpy(&(interface->addresses)->raw, addr, ifa->ifa_addr->sa_family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr));
 
         }
     }
@@ -350,14 +335,15 @@ void enumerateNetworkDevices(struct Interface **interfaces) {
     freeifaddrs(ifaddr);
 }
 
-bool isLocalAddress(char *addr, struct Interface **devices_list) {
+/* whether the raw address addr of family is assigned to one of the devices */
+bool isLocalAddress(int family, const struct in6_addr *addr, struct Interface **devices_list) {
     struct Interface *curr_dev;
 
     for (curr_dev = (*devices_list); curr_dev != NULL; curr_dev = curr_dev->next) {
         struct Address *address = curr_dev->addresses;
 
         while (address != NULL) {
-            if (strcmp(addr, address->ip) == 0)
+            if (address->s_addr.ss_family == family && addressEqual(family, addr, &address->raw))
                 return true;
             address = address->next;
         }
@@ -365,11 +351,11 @@ bool isLocalAddress(char *addr, struct Interface **devices_list) {
     return false;
 }
 
-bool is_dns_cached(char *ip) {
+bool is_dns_cached(int family, const struct in6_addr *ip) {
     struct DNSCache *temp = dns_cache;
 
     while (temp != NULL) {
-        if (strcmp(temp->ip, ip) == 0) {
+        if (temp->family == family && addressEqual(family, &temp->ip, ip)) {
             return true;
         }
         temp = temp->next;
@@ -377,7 +363,7 @@ bool is_dns_cached(char *ip) {
     return false;
 }
 
-void add_dns_cache(char *ip, char *hostname) {
+void add_dns_cache(int family, const struct in6_addr *ip, uint32_t hostname) {
     NFTOP_DNS_ITER++;
 
     // Initialize the DNS cache if it's empty
@@ -391,8 +377,9 @@ void add_dns_cache(char *ip, char *hostname) {
     }
 
     // Copy IP and hostname data to the current cache node
-    strncpy(dns_cache_head->hostname, hostname, NI_MAXHOST-1);
-    strncpy(dns_cache_head->ip, ip, INET6_ADDRSTRLEN-1);
+    dns_cache_head->hostname = hostname;
+    dns_cache_head->family = family;
+    memcpy(&dns_cache_head->ip, ip, sizeof(struct in6_addr));
 
     // Move the head to the next node, or wrap around
     if (NFTOP_DNS_ITER < NFTOP_MAX_DNS) {
@@ -425,90 +412,58 @@ void free_dns_cache() {
     head = NULL;
 }
 
-char *get_cached_dns(char *ip) {
+struct DNSCache *get_cached_dns(int family, const struct in6_addr *ip) {
     struct DNSCache *temp = dns_cache;
 
     while (temp != NULL) {
-        if (strcmp(temp->ip, ip) == 0) {
-            return temp->hostname;
+        if (temp->family == family && addressEqual(family, &temp->ip, ip)) {
+            return temp;
         }
         temp = temp->next;
     }
-    return '\0';
+    return NULL;
 }
 
-void addr2host(struct Connection *ct_info) {
+/* the interned name of the raw address ip, from the cache or by a reverse lookup; 0 (empty) if it has none */
+static uint32_t addr2name(int family, const struct in6_addr *ip) {
     struct sockaddr_storage addr;
     struct sockaddr *sa = (struct sockaddr *)&addr;
-    socklen_t sa_len = sizeof(addr);
-
-    memset(&addr, 0, sizeof(addr));
-
-    char hostname_src[NI_MAXHOST], hostname_dst[NI_MAXHOST];
-    char *from_cache;
-    int resolved;
+    char resolved[NI_MAXHOST];
+    struct DNSCache *cached;
+    uint32_t hostname;
 
-    if (!NFTOP_U_NUMERIC_SRC) {
-        if (strlen(ct_info->local.hostname_src) < 1 && NFTOP_U_REDACT_SRC == 0) {
-            if (ct_info->proto_l3 == AF_INET) {
-                inet_pton(ct_info->proto_l3, ct_info->local.src, &((struct sockaddr_in *)sa)->sin_addr);
+    if ((cached = get_cached_dns(family, ip)) != NULL)
+        return cached->hostname;
 
-                ((struct sockaddr_in *)sa)->sin_family = ct_info->proto_l3;
-                ((struct sockaddr_in *)sa)->sin_port = htons(0);
-            } else {
-                inet_pton(ct_info->proto_l3, ct_info->local.src, &((struct sockaddr_in6 *)sa)->sin6_addr);
-
-                ((struct sockaddr_in6 *)sa)->sin6_family = ct_info->proto_l3;
-                ((struct sockaddr_in6 *)sa)->sin6_port = htons(0);
-            }
-
-            from_cache = get_cached_dns(ct_info->local.src);
-
-            if (!from_cache) {
-                resolved = getnameinfo(sa, sa_len, hostname_src, sizeof(hostname_src), NULL, 0, NI_NAMEREQD);
-                if (resolved == 0) {
-                    strncpy(ct_info->local.hostname_src, hostname_src, NFTOP_MAX_HOSTNAME);
-                    add_dns_cache(ct_info->local.src, hostname_src);
-                } else {
-                    add_dns_cache(ct_info->local.src, ct_info->local.src);
-                }
-            } else {
-                strncpy(ct_info->local.hostname_src, from_cache, NFTOP_MAX_HOSTNAME);
-                ct_info->local.hostname_src[NFTOP_MAX_HOSTNAME] = '\0';
-            }
-        }
+    memset(&addr, 0, sizeof(addr));
+    if (family == AF_INET) {
+        ((struct sockaddr_in *)sa)->sin_family = AF_INET;
+        memcpy(&((struct sockaddr_in *)sa)->sin_addr, ip, sizeof(struct in_addr));
+    } else {
+        ((struct sockaddr_in6 *)sa)->sin6_family = AF_INET6;
+        memcpy(&((struct sockaddr_in6 *)sa)->sin6_addr, ip, sizeof(struct in6_addr));
     }
 
-    if (!NFTOP_U_NUMERIC_DST) {
-        if (strlen(ct_info->local.hostname_dst) < 1 && NFTOP_U_REDACT_DST == 0) {
-            inet_pton(ct_info->proto_l3, ct_info->local.dst, (struct sockaddr *)sa);
+    // addresses without a name are cached too, so that they aren't looked up again
+    if (getnameinfo(sa, sizeof(addr), resolved, sizeof(resolved), NULL, 0, NI_NAMEREQD) != 0)
+        *resolved = '\0';
+    hostname = internString(resolved);
+    add_dns_cache(family, ip, hostname);
 
-            if (ct_info->proto_l3 == AF_INET) {
-                inet_pton(ct_info->proto_l3, ct_info->local.dst, &((struct sockaddr_in *)sa)->sin_addr);
+    return hostname;
+}
 
-                ((struct sockaddr_in *)sa)->sin_family = ct_info->proto_l3;
-                ((struct sockaddr_in *)sa)->sin_port = htons(0);
-            } else {
-                inet_pton(ct_info->proto_l3, ct_info->local.dst, &((struct sockaddr_in6 *)sa)->sin6_addr);
+void addr2host(const struct Connections *conns, uint32_t ct) {
+    struct ConnectionInfo *info = conns->info[ct];
 
-                ((struct sockaddr_in6 *)sa)->sin6_family = ct_info->proto_l3;
-                ((struct sockaddr_in6 *)sa)->sin6_port = htons(0);
-            }
+    if (!NFTOP_U_NUMERIC_SRC && NFTOP_U_REDACT_SRC == 0 && !(info->resolved & NFTOP_RESOLVED_SRC)) {
+        info->hostname_src = addr2name(conns->proto_l3[ct], &conns->addrs[ct].orig_src);
+        info->resolved |= NFTOP_RESOLVED_SRC;
+    }
 
-            from_cache = get_cached_dns(ct_info->local.dst);
-            if (!from_cache) {
-                resolved = getnameinfo(sa, sa_len, hostname_dst, sizeof(hostname_dst), NULL, 0, NI_NAMEREQD);
-                if (resolved == 0) {
-                    strncpy(ct_info->local.hostname_dst, hostname_dst, NFTOP_MAX_HOSTNAME);
-                    add_dns_cache(ct_info->local.dst, hostname_dst);
-                } else {
-                    add_dns_cache(ct_info->local.dst, ct_info->local.dst);
-                }
-            } else {
-                strncpy(ct_info->local.hostname_dst, from_cache, NFTOP_MAX_HOSTNAME);
-                ct_info->local.hostname_dst[NFTOP_MAX_HOSTNAME] = '\0';
-            }
-        }
+    if (!NFTOP_U_NUMERIC_DST && NFTOP_U_REDACT_DST == 0 && !(info->resolved & NFTOP_RESOLVED_DST)) {
+        info->hostname_dst = addr2name(conns->proto_l3[ct], &conns->addrs[ct].orig_dst);
+        info->resolved |= NFTOP_RESOLVED_DST;
     }
 }
 
@@ -519,19 +474,158 @@ int is_redirected() {
    return 0;
 }
 
-struct Interface *getIfaceForRoute(int proto, struct sockaddr_storage *target_ip, struct sockaddr_storage *source_ip, int mark, struct Interface **devices_list) {
-    struct Interface *curr_dev;
+/* CLOCK_MONOTONIC in nanoseconds; used to timestamp counter observations */
+uint64_t monotonic_ns() {
+    struct timespec ts;
 
-    int sock_fd;
-    struct sockaddr_nl sa;
-    struct rtattr *rta;
-    char buffer[ROUTESIZE];
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* CPU time used by all threads of the process, in nanoseconds */
+uint64_t process_cpu_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Route lookups go out on one persistent rtnetlink socket per namespace. Lookups queued with
+ * routeQueue() are packed into one datagram per namespace by routeFlush(); rtnetlink answers
+ * each of them, and the answers are kept in a table for the rest of the interval, where
+ * getIfaceForRoute() finds them. Lookups it doesn't find are made on the spot.
+ *
+ * Each namespace's socket has a second one listening for route, rule, address and link changes.
+ * routeReset() drains it and counts the intervals in which something changed as the namespace's
+ * epoch; interfaces found while the epoch stays the same can be kept from one interval to the next.
+ */
+struct RouteKey {
+    struct in6_addr target;
+    struct in6_addr source;
+    uint32_t mark;
+    uint16_t slot;          // namespace socket: 0 for nftop's own, 1 + the index of an entered one
+    uint8_t proto;
+    uint8_t has_source;
+};
+
+#define ROUTE_QUEUED    1
+#define ROUTE_RESOLVED  2
+
+struct RouteRequest {
+    struct nlmsghdr nlh;
+    struct rtmsg rtm;
+    char attrbuf[2 * RTA_SPACE(sizeof(struct in6_addr)) + RTA_SPACE(sizeof(uint32_t))];
+};
+
+struct RouteEntry {
+    struct RouteKey key;
+    uint32_t generation;    // interval the entry was made in
+    int state;
     char iface[IF_NAMESIZE];
-    strncpy(iface, "", IF_NAMESIZE);
+};
+
+struct RouteSocket {
+    int fd;
+    int monitor;            // subscribed to the changes that can move a route; -1 if it couldn't be
+    uint32_t epoch;         // intervals with changes seen on monitor, from 1
+    char *batch;            // queued requests, sent as one datagram
+    size_t batch_len;
+    int queued;
+    int pending;            // requests of the last datagram not answered yet
+};
+
+static struct RouteEntry *route_cache = NULL;
+static uint32_t route_generation = 1;
+static size_t route_cache_count = 0;
+static struct RouteSocket *route_sockets[NFTOP_MAX_NETNS + 1];
+
+static char route_rbuf[NFTOP_ROUTE_RECV_VLEN][ROUTESIZE];
+
+static int route_addr_size(int proto) {
+    switch(proto) {
+        case AF_INET:
+            return sizeof(struct in_addr);
+        case AF_INET6:
+            return sizeof(struct in6_addr);
+    }
+    return 0;
+}
+
+static void route_key(struct RouteKey *key, int proto, const struct in6_addr *target_ip, const struct in6_addr *source_ip, int mark) {
+    int addr_size = route_addr_size(proto);
+
+    memset(key, 0, sizeof(*key));
+    key->proto = proto;
+    key->mark = mark;
+    key->slot = netnsCurrent() + 1;
+
+    memcpy(&key->target, target_ip, addr_size);
+    if (source_ip != NULL) {
+        memcpy(&key->source, source_ip, addr_size);
+        key->has_source = 1;
+    }
+}
+
+/* the entry of key made during this interval, or a new one */
+static struct RouteEntry *route_entry(const struct RouteKey *key) {
+    const uint8_t *p = (const uint8_t *)key;
+    struct RouteEntry *entry;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    if (route_cache == NULL && !(route_cache = calloc(NFTOP_ROUTE_CACHE, sizeof(struct RouteEntry)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < sizeof(*key); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+
+    for (i = hash & (NFTOP_ROUTE_CACHE - 1); ; i = (i + 1) & (NFTOP_ROUTE_CACHE - 1)) {
+        entry = &route_cache[i];
+        if (entry->generation != route_generation)
+            break;
+        if (memcmp(&entry->key, key, sizeof(*key)) == 0)
+            return entry;
+    }
+
+    // keep probes short: a full table is emptied once the queued lookups are answered
+    if (route_cache_count >= NFTOP_ROUTE_CACHE / 4 * 3) {
+        routeFlush();
+        routeReset();
+        return route_entry(key);
+    }
+    route_cache_count++;
+
+    memcpy(&entry->key, key, sizeof(*key));
+    entry->generation = route_generation;
+    entry->state = 0;
+    entry->iface[0] = '\0';
+
+    return entry;
+}
+
+/* the socket of the namespace the thread is in, created on first use */
+static struct RouteSocket *route_socket(uint16_t slot) {
+    struct RouteSocket *rs;
+    struct sockaddr_nl sa;
+    struct timeval tv = { .tv_sec = 0, .tv_usec = NFTOP_ROUTE_TIMEOUT * 1000000 };
+    int rcvbuf = NFTOP_ROUTE_RCVBUF, group = RTNLGRP_IPV6_RULE;
+
+    if (route_sockets[slot] != NULL)
+        return route_sockets[slot];
+
+    if (!(rs = calloc(1, sizeof(struct RouteSocket))) || !(rs->batch = malloc(NFTOP_ROUTE_BATCH_MAX * NLMSG_ALIGN(sizeof(struct RouteRequest))))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
 
     // Create a netlink socket
-    sock_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
-    if (sock_fd == -1) {
+    rs->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (rs->fd == -1) {
         perror("socket");
         exit(EXIT_FAILURE);
     }
@@ -542,145 +636,330 @@ struct Interface *getIfaceForRoute(int proto, struct sockaddr_storage *target_ip
     sa.nl_groups = 0; // No multicast groups
 
     // Bind the socket
-    if (bind(sock_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    if (bind(rs->fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
         perror("bind");
-        close(sock_fd);
+        close(rs->fd);
         exit(EXIT_FAILURE);
     }
 
-    // Prepare and send the request message
-    struct {
-        struct nlmsghdr nlh;
-        struct rtmsg rtm;
-        char attrbuf[ROUTESIZE];
-    } req;
+    // the answers to a whole batch are queued before any is read
+    if (setsockopt(rs->fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+        setsockopt(rs->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(rs->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-    memset(&req, 0, sizeof(req));
-    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-    req.nlh.nlmsg_type = RTM_GETROUTE;
-    req.nlh.nlmsg_flags = NLM_F_REQUEST;
-    req.rtm.rtm_family = proto;
+    // opened in the same namespace, before any of its routes are looked up, so no change goes unseen
+    rs->epoch = 1;
+    rs->monitor = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE | RTMGRP_IPV4_RULE;
+    if (rs->monitor != -1 && bind(rs->monitor, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+        DLOG(NFTOP_FLAGS_DEBUG, "route monitor: %s\n", strerror(errno));
+        close(rs->monitor);
+        rs->monitor = -1;
+    }
+    if (rs->monitor != -1 && setsockopt(rs->monitor, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) == -1) {
+        close(rs->monitor);
+        rs->monitor = -1;
+    }
 
-    // Add the target IP address to the request
-    rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nlh.nlmsg_len));
-    rta->rta_type = RTA_DST;
+    route_sockets[slot] = rs;
 
-    int addr_size = 0;
-    switch(proto) {
-        case AF_INET:
-            addr_size = sizeof(struct in_addr);
-            break;
-        case AF_INET6:
-            addr_size = sizeof(struct in6_addr);
-            break;
-        default:
-            addr_size = sizeof(struct sockaddr_storage);
-    }
+    return rs;
+}
 
+/* appends the request for entry to the batch of its namespace's socket */
+static void route_request(struct RouteSocket *rs, struct RouteEntry *entry) {
+    struct RouteRequest *req = (struct RouteRequest *)(rs->batch + rs->batch_len);
+    struct rtattr *rta;
+    int addr_size = route_addr_size(entry->key.proto);
+
+    memset(req, 0, sizeof(*req));
+    req->nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req->nlh.nlmsg_type = RTM_GETROUTE;
+    req->nlh.nlmsg_flags = NLM_F_REQUEST;
+    req->nlh.nlmsg_seq = entry - route_cache;   // answers are matched to their entry by sequence number
+    req->rtm.rtm_family = entry->key.proto;
+
+    // Add the target IP address to the request
+    rta = (struct rtattr *)((char *)req + NLMSG_ALIGN(req->nlh.nlmsg_len));
+    rta->rta_type = RTA_DST;
     rta->rta_len = RTA_LENGTH(addr_size);
-    memcpy(RTA_DATA(rta), target_ip, addr_size);
-    // Set the request message length
-    req.nlh.nlmsg_len += RTA_LENGTH(addr_size);
+    memcpy(RTA_DATA(rta), &entry->key.target, addr_size);
+    req->nlh.nlmsg_len = NLMSG_ALIGN(req->nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
 
     // Add the source IP address
-    if (&source_ip->ss_family != NULL) {
-        rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nlh.nlmsg_len));
+    if (entry->key.has_source) {
+        rta = (struct rtattr *)((char *)req + NLMSG_ALIGN(req->nlh.nlmsg_len));
         rta->rta_type = RTA_SRC;
         rta->rta_len = RTA_LENGTH(addr_size);
-        memcpy(RTA_DATA(rta), source_ip, addr_size);
-        req.nlh.nlmsg_len += RTA_LENGTH(addr_size);
+        memcpy(RTA_DATA(rta), &entry->key.source, addr_size);
+        req->nlh.nlmsg_len = NLMSG_ALIGN(req->nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
     }
 
-    if (mark != 0) {
-        rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nlh.nlmsg_len));
+    if (entry->key.mark != 0) {
+        rta = (struct rtattr *)((char *)req + NLMSG_ALIGN(req->nlh.nlmsg_len));
         rta->rta_type = RTA_MARK;
-        rta->rta_len = RTA_LENGTH(sizeof(int));
-        memcpy(RTA_DATA(rta), &mark, sizeof(int));
-        req.nlh.nlmsg_len += RTA_LENGTH(sizeof(int));
+        rta->rta_len = RTA_LENGTH(sizeof(uint32_t));
+        memcpy(RTA_DATA(rta), &entry->key.mark, sizeof(uint32_t));
+        req->nlh.nlmsg_len = NLMSG_ALIGN(req->nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
     }
 
-    // Send the request
-    if (send(sock_fd, &req, req.nlh.nlmsg_len, 0) == -1) {
-        perror("send");
-        close(sock_fd);
-        exit(EXIT_FAILURE);
-    }
+    rs->batch_len += NLMSG_ALIGN(req->nlh.nlmsg_len);
+    rs->queued++;
+    entry->state = ROUTE_QUEUED;
+}
 
-    // Receive and process the response
-    ssize_t len = recv(sock_fd, buffer, ROUTESIZE, 0);
-    struct nlmsghdr *nlh = (struct nlmsghdr *)buffer;
+/* the output interface of a route, from an RTM_NEWROUTE answer */
+static void route_reply(const struct nlmsghdr *nlh, int proto, char *iface) {
+    struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+    struct rtattr *rta = (struct rtattr *)RTM_RTA(rtm);
+    int route_len = RTM_PAYLOAD(nlh);
+    struct sockaddr_storage ip;
+    char ip_str[INET6_ADDRSTRLEN];
+    char if_str[IF_NAMESIZE];
+
+    while (RTA_OK(rta, route_len)) {
+        switch(rta->rta_type) {
+            case RTA_IIF:
+                if_indextoname(*(unsigned int *)RTA_DATA(rta), if_str);
+                DLOG(NFTOP_FLAGS_DEBUG, "iif: %s (%u)\n", if_str, *(unsigned int *)RTA_DATA(rta));
+                break;
+            case RTA_OIF:
+                if_indextoname(*(unsigned int *)RTA_DATA(rta), if_str);
+                DLOG(NFTOP_FLAGS_DEBUG, "oif: %s (%u)\n", if_str, *(unsigned int *)RTA_DATA(rta));
+                strncpy(iface, if_str, IF_NAMESIZE);
+                break;
+            case RTA_SRC:
+                memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
+
+                inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
+                DLOG(NFTOP_FLAGS_DEBUG, "Source IP: %s\n", ip_str);
+                break;
+            case RTA_DST:
+                memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
+
+                inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
+                DLOG(NFTOP_FLAGS_DEBUG, "Destination IP: %s\n", ip_str);
+                break;
+            case RTA_GATEWAY:
+                memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
+
+                inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
+                DLOG(NFTOP_FLAGS_DEBUG, "Gateway: %s\n", ip_str);
+                break;
+            case RTA_PREFSRC:
+                memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
+
+                inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
+                DLOG(NFTOP_FLAGS_DEBUG, "Pref-Source: %s\n", ip_str);
+                break;
+            default:
+                DLOG(NFTOP_FLAGS_DEBUG, "rta->rta_type: %d\n", rta->rta_type);
+                break;
 
-    while (NLMSG_OK(nlh, len)) {
-        if (nlh->nlmsg_type == NLMSG_DONE) {
-            break;
         }
 
-        if (nlh->nlmsg_type == RTM_NEWROUTE) {
-            struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
-            struct rtattr *rta = (struct rtattr *)RTM_RTA(rtm);
-            int route_len = RTM_PAYLOAD(nlh);
-            struct sockaddr_storage ip;
-            char ip_str[INET6_ADDRSTRLEN];
-            char if_str[IF_NAMESIZE];
-
-            while (RTA_OK(rta, route_len)) {
-                switch(rta->rta_type) {
-                    case RTA_IIF:
-                        if_indextoname(*(unsigned int *)RTA_DATA(rta), if_str);
-                        DLOG(NFTOP_FLAGS_DEBUG, "iif: %s (%u)\n", if_str, *(unsigned int *)RTA_DATA(rta));
-                        break;
-                    case RTA_OIF:
-                        if_indextoname(*(unsigned int *)RTA_DATA(rta), if_str);
-                        DLOG(NFTOP_FLAGS_DEBUG, "oif: %s (%u)\n", if_str, *(unsigned int *)RTA_DATA(rta));
-                        strncpy(iface, if_str, IF_NAMESIZE);
-                        break;
-                    case RTA_SRC:
-                        memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
-
-                        inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
-                        DLOG(NFTOP_FLAGS_DEBUG, "Source IP: %s\n", ip_str);
-                        break;
-                    case RTA_DST:
-                        memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
-
-                        inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
-                        DLOG(NFTOP_FLAGS_DEBUG, "Destination IP: %s\n", ip_str);
-                        break;
-                    case RTA_GATEWAY:
-                        memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
-
-                        inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
-                        DLOG(NFTOP_FLAGS_DEBUG, "Gateway: %s\n", ip_str);
-                        break;
-                    case RTA_PREFSRC:
-                        memcpy(&ip, RTA_DATA(rta), sizeof(struct sockaddr_storage));
-
-                        inet_ntop(proto, &ip, ip_str, INET6_ADDRSTRLEN);
-                        DLOG(NFTOP_FLAGS_DEBUG, "Pref-Source: %s\n", ip_str);
-                        break;
-                    default:
-                        DLOG(NFTOP_FLAGS_DEBUG, "rta->rta_type: %d\n", rta->rta_type);
-                        break;
-
-                }
-
-                memset(&ip_str, 0, sizeof(ip_str));
-                memset(&if_str, 0, sizeof(if_str));
-
-                rta = RTA_NEXT(rta, route_len);
+        memset(&ip_str, 0, sizeof(ip_str));
+        memset(&if_str, 0, sizeof(if_str));
+
+        rta = RTA_NEXT(rta, route_len);
+    }
+}
+
+/* resolves the entries answered in a datagram; stops (0) once the whole batch is answered */
+static int route_recv(const char *buf, size_t len, void *data) {
+    struct RouteSocket *rs = (struct RouteSocket *) data;
+    const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+    struct RouteEntry *entry;
+    int nlen = len;
+
+    while (NLMSG_OK(nlh, nlen)) {
+        if (nlh->nlmsg_seq < NFTOP_ROUTE_CACHE && route_cache != NULL) {
+            entry = &route_cache[nlh->nlmsg_seq];
+
+            if (entry->state == ROUTE_QUEUED && entry->generation == route_generation) {
+                // an error (e.g. no route) leaves the interface empty
+                if (nlh->nlmsg_type == RTM_NEWROUTE)
+                    route_reply(nlh, entry->key.proto, entry->iface);
+                entry->state = ROUTE_RESOLVED;
+                rs->pending--;
             }
+        }
 
+        nlh = NLMSG_NEXT(nlh, nlen);
+    }
+
+    return rs->pending > 0 ? 1 : 0;
+}
+
+/* sends the batch of a socket and reads the answers with recvmmsg(); returns the syscalls made */
+static int route_exchange(struct RouteSocket *rs) {
+    struct mmsghdr msgs[NFTOP_ROUTE_RECV_VLEN];
+    struct iovec iov[NFTOP_ROUTE_RECV_VLEN];
+    int syscalls = 1, n, i;
+
+    if (send(rs->fd, rs->batch, rs->batch_len, 0) == -1) {
+        DLOG(NFTOP_FLAGS_DEBUG, "send: %s\n", strerror(errno));
+        return syscalls;
+    }
+
+    for (i = 0; i < NFTOP_ROUTE_RECV_VLEN; i++) {
+        iov[i].iov_base = route_rbuf[i];
+        iov[i].iov_len = ROUTESIZE;
+    }
+
+    // rtnetlink answers from within send(), so every answer is queued by now
+    while (rs->pending > 0) {
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < NFTOP_ROUTE_RECV_VLEN; i++) {
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
         }
 
-        nlh = NLMSG_NEXT(nlh, len);
+        syscalls++;
+        if ((n = recvmmsg(rs->fd, msgs, NFTOP_ROUTE_RECV_VLEN, MSG_WAITFORONE, NULL)) == -1) {
+            DLOG(NFTOP_FLAGS_DEBUG, "recvmmsg: %s\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+            route_recv(route_rbuf[i], msgs[i].msg_len, rs);
     }
-    close(sock_fd);
+
+    return syscalls;
+}
+
+/* sends the batch of a socket; entries left unanswered are looked up again when used */
+static void route_send(struct RouteSocket *rs) {
+    int syscalls;
+
+    rs->pending = rs->queued;
+
+    syscalls = route_exchange(rs);
+
+    DLOG(NFTOP_FLAGS_DEBUG, "route lookups: %d sent, %d unanswered, %d syscalls\n", rs->queued, rs->pending, syscalls);
+
+    rs->batch_len = 0;
+    rs->queued = 0;
+}
+
+/* queues the lookup made by getIfaceForRoute() with the same arguments, in the namespace the thread is in */
+void routeQueue(int proto, const struct in6_addr *target_ip, const struct in6_addr *source_ip, int mark) {
+    struct RouteSocket *rs;
+    struct RouteEntry *entry;
+    struct RouteKey key;
+
+    route_key(&key, proto, target_ip, source_ip, mark);
+    if ((entry = route_entry(&key)) == NULL || entry->state != 0)
+        return;
+
+    rs = route_socket(key.slot);
+    route_request(rs, entry);
+    if (rs->queued == NFTOP_ROUTE_BATCH_MAX)
+        route_send(rs);
+}
+
+/* sends the queued lookups, one datagram per namespace */
+void routeFlush() {
+    int slot;
+
+    for (slot = 0; slot <= NFTOP_MAX_NETNS; slot++) {
+        if (route_sockets[slot] != NULL && route_sockets[slot]->queued > 0)
+            route_send(route_sockets[slot]);
+    }
+}
+
+/* reads the notifications of a socket's monitor; a new epoch starts if there were any, or some were lost */
+static void route_monitor(struct RouteSocket *rs) {
+    bool changed = false;
+    ssize_t len;
+
+    if (rs->monitor == -1)
+        return;
+
+    while ((len = recv(rs->monitor, route_rbuf[0], ROUTESIZE, MSG_DONTWAIT)) != 0) {
+        if (len == -1 && errno != ENOBUFS)
+            break;
+        changed = true;
+    }
+
+    if (changed && ++rs->epoch == 0)
+        rs->epoch = 1;
+}
+
+/* forgets the lookups of the previous interval, so that route changes show */
+void routeReset() {
+    int slot;
+
+    if (++route_generation == 0)
+        route_generation = 1;
+    route_cache_count = 0;
+
+    for (slot = 0; slot <= NFTOP_MAX_NETNS; slot++) {
+        if (route_sockets[slot] != NULL)
+            route_monitor(route_sockets[slot]);
+    }
+}
+
+/*
+ * the epoch of the namespace the thread is in: the same for as long as no route, rule, address or
+ * link of it changed; 0 (never the same) before its first lookup, or without notifications
+ */
+uint32_t routeEpoch() {
+    struct RouteSocket *rs = route_sockets[netnsCurrent() + 1];
+
+    return rs != NULL && rs->monitor != -1 ? rs->epoch : 0;
+}
+
+void routeClose() {
+    int slot;
+
+    for (slot = 0; slot <= NFTOP_MAX_NETNS; slot++) {
+        if (route_sockets[slot] == NULL)
+            continue;
+        close(route_sockets[slot]->fd);
+        if (route_sockets[slot]->monitor != -1)
+            close(route_sockets[slot]->monitor);
+        free(route_sockets[slot]->batch);
+        free(route_sockets[slot]);
+        route_sockets[slot] = NULL;
+    }
+
+    free(route_cache);
+    route_cache = NULL;
+}
+
+struct Interface *getIfaceForRoute(int proto, const struct in6_addr *target_ip, const struct in6_addr *source_ip, int mark, struct Interface **devices_list) {
+    struct Interface *curr_dev;
+    struct RouteEntry *entry;
+    struct RouteSocket *rs;
+    struct RouteKey key;
+
+    route_key(&key, proto, target_ip, source_ip, mark);
+    entry = route_entry(&key);
+
+    // not queued beforehand: look it up now, along with anything still queued
+    if (entry->state != ROUTE_RESOLVED) {
+        rs = route_socket(key.slot);
+
+        if (entry->state == ROUTE_QUEUED && rs->queued > 0)
+            route_send(rs);
+        if (entry->state != ROUTE_RESOLVED) {
+            route_request(rs, entry);
+            route_send(rs);
+        }
+    }
+
+    // unanswered, or no route: no interface
+    if (entry->state != ROUTE_RESOLVED)
+        return NULL;
 
     for (curr_dev = (*devices_list); curr_dev != NULL; curr_dev = curr_dev->next) {
-        if (strcmp(iface, curr_dev->name) == 0) {
+        if (strcmp(entry->iface, curr_dev->name) == 0) {
             return curr_dev;
         }
     }
 
     return NULL;
-}
\ No newline at end of file
+}
@@ -10,6 +10,7 @@
 #define _NFTOP_UTIL_H
 #define _GNU_SOURCE
 #include <stdarg.h>
+#include <string.h>
 
 #define DLOG(loglevel, f_, ...)    do {         \
     if (loglevel > 0) {\
@@ -18,21 +19,37 @@
     }\
 } while (0)
 
+#define NFTOP_ROUTE_BATCH       32          // flows whose route lookups are queued before the lookups are sent
+#define NFTOP_ROUTE_BATCH_MAX   128         // route lookups sent in one datagram
+#define NFTOP_ROUTE_CACHE       16384       // route lookups remembered for the rest of the interval (a power of 2)
+#define NFTOP_ROUTE_RCVBUF      (1 << 20)   // receive buffer of the route sockets, holding the answers to a batch
+#define NFTOP_ROUTE_RECV_VLEN   16          // answers read by one recvmmsg()
+#define NFTOP_ROUTE_TIMEOUT     0.1         // seconds to wait for the answers to a batch
+
+#define NFTOP_UOM_LEN           24          // a rate formatted by formatUOM(), e.g. "1023.9 Kibps" or a bare -b count
+#define NFTOP_PROTO_LEN         8           // a protocol name of getIPProtocolName(), e.g. "icmp6" or "132"
 
 struct Address {
     char ip[INET6_ADDRSTRLEN];
     char netmask[INET6_ADDRSTRLEN];
     struct sockaddr_storage s_addr;
     struct sockaddr_storage s_mask;
+    struct in6_addr raw;    // s_addr as a raw address, IPv4 in the first 4 bytes
     int64_t bps_rx;
     int64_t bps_tx;
     int64_t bps_sum;
     struct Address *next;
 };
 
+/* raw addresses (IPv4 in the first 4 bytes) are compared over the size of their family */
+static inline bool addressEqual(int family, const struct in6_addr *a, const struct in6_addr *b) {
+    return memcmp(a, b, family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr)) == 0;
+}
+
 struct DNSCache {
-    char ip[INET6_ADDRSTRLEN];
-    char hostname[NI_MAXHOST];
+    int family;
+    struct in6_addr ip;
+    uint32_t hostname;      // interned; 0 for an address without a name
     struct DNSCache *next;
 };
 
@@ -41,20 +58,27 @@ void reset_terminal_mode();
 
 char* getSortIndicator(int);
 char* getProtocolName(uint8_t);
-char* getIPProtocolName(uint8_t, uint8_t);
-char* formatUOM(uint64_t);
-void freeConnectionTrackingList(struct Connection*);
+char* getIPProtocolName(uint8_t, uint8_t, char *, size_t);
+char* formatUOM(uint64_t, char *, size_t);
 void freeDeviceList(struct Interface*);
+void add_interface(struct Interface **, const char *);
 void free_interfaces(struct Interface **);
-bool isLocalAddress(char *, struct Interface **);
+void free_device_pool();
+bool isLocalAddress(int, const struct in6_addr *, struct Interface **);
 void enumerateNetworkDevices(struct Interface **);
-void addr2host(struct Connection *ct_info);
+void addr2host(const struct Connections *conns, uint32_t ct);
 int is_redirected();
-void add_ct(struct Connection **head, struct Connection *curr_ct);
-bool is_dns_cached(char *ip);
-void add_dns_cache(char *ip, char *hostname);
+uint64_t monotonic_ns();
+uint64_t process_cpu_ns();
+bool is_dns_cached(int, const struct in6_addr *);
+void add_dns_cache(int, const struct in6_addr *, uint32_t);
 void free_dns_cache();
-char *get_cached_dns(char *);
-struct Interface *getIfaceForRoute(int, struct sockaddr_storage *, struct sockaddr_storage *, int, struct Interface **);
+struct DNSCache *get_cached_dns(int, const struct in6_addr *);
+struct Interface *getIfaceForRoute(int, const struct in6_addr *, const struct in6_addr *, int, struct Interface **);
+void routeQueue(int, const struct in6_addr *, const struct in6_addr *, int);
+void routeFlush();
+void routeReset();
+uint32_t routeEpoch();
+void routeClose();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,207 @@
+/* tests/bench_addr: the per-flow address handling of a refresh, with addresses as text and as raw binary */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include "../src/nftop.h"
+#include "../src/util.h"
+
+#define FLOWS           100000
+#define ADDRESSES       8       // addresses assigned to the local devices
+#define ITERATIONS      10
+#define IPV6_PERCENT    20
+
+/* a local address both ways, as struct Address holds it */
+struct Local {
+    int family;
+    char ip[INET6_ADDRSTRLEN];
+    struct in6_addr raw;
+};
+
+/* the addresses of a connection as text, as they were formatted for every flow of a dump */
+struct Text {
+    char src[INET6_ADDRSTRLEN];
+    char dst[INET6_ADDRSTRLEN];
+    char repl_src[INET6_ADDRSTRLEN];
+    char repl_dst[INET6_ADDRSTRLEN];
+};
+
+static double elapsed(struct timespec *start, struct timespec *stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e9 + (stop->tv_nsec - start->tv_nsec);
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void random_address(uint64_t *state, int family, struct in6_addr *addr) {
+    uint64_t r[2] = { xorshift(state), xorshift(state) };
+
+    memset(addr, 0, sizeof(*addr));
+    memcpy(addr, r, family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr));
+}
+
+/*
+ * formatting the four addresses of the flow, the local destination check of set_rates() and the
+ * address accounting of the interface lookup, all by strcmp() on the text
+ */
+static int text_path(const struct Flow *flow, struct Text *text, const struct Local *locals, int n) {
+    int i, hits = 0;
+
+    inet_ntop(flow->proto_l3, &flow->orig_src, text->src, sizeof(text->src));
+    inet_ntop(flow->proto_l3, &flow->orig_dst, text->dst, sizeof(text->dst));
+    inet_ntop(flow->proto_l3, &flow->repl_src, text->repl_src, sizeof(text->repl_src));
+    inet_ntop(flow->proto_l3, &flow->repl_dst, text->repl_dst, sizeof(text->repl_dst));
+
+    for (i = 0; i < n; i++) {
+        if (strcmp(text->dst, locals[i].ip) == 0) {
+            hits++;
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (strcmp(text->src, locals[i].ip) == 0 || strcmp(text->repl_dst, locals[i].ip) == 0 || strcmp(text->dst, locals[i].ip) == 0) {
+            hits++;
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (strcmp(text->repl_src, locals[i].ip) == 0 || strcmp(text->repl_dst, locals[i].ip) == 0 || strcmp(text->src, locals[i].ip) == 0) {
+            hits++;
+            break;
+        }
+    }
+
+    return hits;
+}
+
+/* the same, with the raw addresses copied into the connection's and compared with addressEqual() */
+static int binary_path(const struct Flow *flow, struct ConnectionAddresses *ct, const struct Local *locals, int n) {
+    int family = flow->proto_l3, i, hits = 0;
+
+    memcpy(&ct->orig_src, &flow->orig_src, sizeof(struct in6_addr));
+    memcpy(&ct->orig_dst, &flow->orig_dst, sizeof(struct in6_addr));
+    memcpy(&ct->repl_src, &flow->repl_src, sizeof(struct in6_addr));
+    memcpy(&ct->repl_dst, &flow->repl_dst, sizeof(struct in6_addr));
+
+    for (i = 0; i < n; i++) {
+        if (locals[i].family == family && addressEqual(family, &ct->orig_dst, &locals[i].raw)) {
+            hits++;
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (locals[i].family == family && (addressEqual(family, &ct->orig_src, &locals[i].raw)
+            || addressEqual(family, &ct->repl_dst, &locals[i].raw) || addressEqual(family, &ct->orig_dst, &locals[i].raw))) {
+            hits++;
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (locals[i].family == family && (addressEqual(family, &ct->repl_src, &locals[i].raw)
+            || addressEqual(family, &ct->repl_dst, &locals[i].raw) || addressEqual(family, &ct->orig_src, &locals[i].raw))) {
+            hits++;
+            break;
+        }
+    }
+
+    return hits;
+}
+
+int bench(size_t n, int addresses, int iterations) {
+    struct timespec start, stop;
+    struct Local *locals;
+    struct Flow *flows;
+    struct ConnectionAddresses ct;
+    struct Text text;
+    uint64_t state = 88172645463325252ULL;
+    long hits_text = 0, hits_binary = 0;
+    double t_text = 0, t_binary = 0;
+    size_t i;
+    int j;
+
+    if (!(flows = calloc(n, sizeof(struct Flow))) || !(locals = calloc(addresses, sizeof(struct Local)))) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (j = 0; j < addresses; j++) {
+        locals[j].family = j % 2 ? AF_INET6 : AF_INET;
+        random_address(&state, locals[j].family, &locals[j].raw);
+        inet_ntop(locals[j].family, &locals[j].raw, locals[j].ip, sizeof(locals[j].ip));
+    }
+
+    // a quarter of the flows are to or from a local address, as on a host; the rest are forwarded
+    for (i = 0; i < n; i++) {
+        flows[i].proto_l3 = xorshift(&state) % 100 < IPV6_PERCENT ? AF_INET6 : AF_INET;
+        random_address(&state, flows[i].proto_l3, &flows[i].orig_src);
+        random_address(&state, flows[i].proto_l3, &flows[i].orig_dst);
+        if (xorshift(&state) % 4 == 0) {
+            j = (xorshift(&state) % ((addresses + 1) / 2)) * 2 + (flows[i].proto_l3 == AF_INET6);
+            if (j < addresses)
+                flows[i].orig_dst = locals[j].raw;
+        }
+        flows[i].repl_src = flows[i].orig_dst;
+        flows[i].repl_dst = flows[i].orig_src;
+    }
+
+    for (j = 0; j < iterations; j++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < n; i++)
+            hits_text += text_path(&flows[i], &text, locals, addresses);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_text += elapsed(&start, &stop);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < n; i++)
+            hits_binary += binary_path(&flows[i], &ct, locals, addresses);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_binary += elapsed(&start, &stop);
+    }
+
+    printf("flows: %zu, local addresses: %d, iterations: %d, local matches: %ld\n", n, addresses, iterations, hits_binary / iterations);
+    printf("text (inet_ntop + strcmp): %8.1f ns/flow\n", t_text / iterations / n);
+    printf("binary (addressEqual):     %8.1f ns/flow\n", t_binary / iterations / n);
+
+    free(locals);
+    free(flows);
+
+    if (hits_text != hits_binary) {
+        printf("mismatch: text matched %ld, binary %ld\n", hits_text, hits_binary);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int c, ret, addresses = ADDRESSES, iterations = ITERATIONS;
+    size_t flows = FLOWS;
+
+    while ((c = getopt(argc, argv, "f:a:n:")) != -1) {
+        switch (c) {
+            case 'f':
+                flows = strtoul(optarg, NULL, 10);
+                break;
+            case 'a':
+                addresses = atoi(optarg);
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-f flows] [-a local addresses] [-n iterations]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    ret = bench(flows > 0 ? flows : 1, addresses > 0 ? addresses : 1, iterations > 0 ? iterations : 1);
+
+    ret == -1 ? exit(EXIT_FAILURE) : exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,161 @@
+/* tests/bench_history: join a generation of synthetic flows against the previous one, by scan and by hash index */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libmnl/libmnl.h>
+#include "../src/nftop.h"
+#include "../src/history.h"
+
+#define SIZES           "10000,100000,1000000"
+#define LINEAR_MAX      100000  // the scan is O(N^2); larger sizes skip it
+#define NEW_PERCENT     10      // flows of the current generation without a previous observation
+
+struct Key {
+    uint32_t id;
+    time_t time_start;
+};
+
+static double elapsed(struct timespec *start, struct timespec *stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e9 + (stop->tv_nsec - start->tv_nsec);
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* the join of main(): the previous observation of every current flow, summed into a checksum */
+static uint64_t join_linear(const struct Connections *history, const struct Key *keys, size_t n, size_t *found) {
+    uint64_t sum = 0;
+    size_t i, hist_ct;
+
+    *found = 0;
+    for (i = 0; i < n; i++) {
+        for (hist_ct = 0; hist_ct < history->count; hist_ct++) {
+            if (keys[i].id == history->id[hist_ct] && keys[i].time_start == history->time_start[hist_ct]) {
+                sum += history->bytes_orig[hist_ct];
+                (*found)++;
+                break;
+            }
+        }
+    }
+
+    return sum;
+}
+
+static uint64_t join_index(struct HistoryIndex *index, const struct Connections *history, const struct Key *keys, size_t n, size_t *found) {
+    ssize_t hist_ct;
+    uint64_t sum = 0;
+    size_t i;
+
+    *found = 0;
+    historyIndex(index, history);
+    for (i = 0; i < n; i++) {
+        if ((hist_ct = historyLookup(index, keys[i].id, keys[i].time_start)) != -1) {
+            sum += history->bytes_orig[hist_ct];
+            (*found)++;
+        }
+    }
+
+    return sum;
+}
+
+int bench(size_t n, size_t linear_max) {
+    struct HistoryIndex index = { NULL, 0, 0 };
+    struct timespec start, stop;
+    struct Connections flows = { 0 };
+    struct Key *keys, tmp;
+    uint64_t state = 88172645463325252ULL, sum_linear = 0, sum_index;
+    size_t found_linear = 0, found_index, i, j;
+    double t_linear = 0, t_index;
+
+    // the previous generation: the kept columns of the flows, IDs random like the kernel's, a few sharing a start second
+    if (!(flows.id = malloc(n * sizeof(uint32_t))) || !(flows.time_start = malloc(n * sizeof(time_t)))
+        || !(flows.bytes_orig = malloc(n * sizeof(uint64_t))) || !(keys = malloc(n * sizeof(struct Key)))) {
+        perror("malloc");
+        return -1;
+    }
+    flows.count = n;
+    for (i = 0; i < n; i++) {
+        flows.id[i] = (uint32_t)xorshift(&state);
+        flows.time_start[i] = 1700000000 + i / 64;
+        flows.bytes_orig[i] = i;
+    }
+
+    // the current generation, in another order, with some flows new
+    for (i = 0; i < n; i++) {
+        keys[i].id = xorshift(&state) % 100 < NEW_PERCENT ? (uint32_t)xorshift(&state) : flows.id[i];
+        keys[i].time_start = flows.time_start[i];
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = xorshift(&state) % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+
+    if (n <= linear_max) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        sum_linear = join_linear(&flows, keys, n, &found_linear);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_linear = elapsed(&start, &stop);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sum_index = join_index(&index, &flows, keys, n, &found_index);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    t_index = elapsed(&start, &stop);
+
+    printf("flows: %8zu, matched: %8zu", n, found_index);
+    if (n <= linear_max)
+        printf(", scan: %10.2f ms (%9.1f ns/flow)", t_linear / 1e6, t_linear / n);
+    else
+        printf(", scan: %10s    %22s", "skipped", "");
+    printf(", index: %8.2f ms (%6.1f ns/flow)\n", t_index / 1e6, t_index / n);
+
+    historyFree(&index);
+    free(keys);
+    free(flows.id);
+    free(flows.time_start);
+    free(flows.bytes_orig);
+
+    if (n <= linear_max && (found_linear != found_index || sum_linear != sum_index)) {
+        printf("mismatch: scan matched %zu, index %zu\n", found_linear, found_index);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int c, ret = 0;
+    size_t linear_max = LINEAR_MAX;
+    char *sizes = strdup(SIZES), *size;
+
+    while ((c = getopt(argc, argv, "s:l:")) != -1) {
+        switch (c) {
+            case 's':
+                free(sizes);
+                sizes = strdup(optarg);
+                break;
+            case 'l':
+                linear_max = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s flows[,flows...]] [-l scan limit]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // the index takes 2 to 4 slots of 16 bytes per flow, besides the 20 bytes of the columns it reads
+    for (size = strtok(sizes, ","); size != NULL && ret == 0; size = strtok(NULL, ","))
+        ret = bench(strtoul(size, NULL, 10), linear_max);
+
+    free(sizes);
+
+    ret == -1 ? exit(EXIT_FAILURE) : exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,182 @@
+/* tests/bench_parse: compare nlmsg2flow (libmnl fast path) against nfct_nlmsg_parse + ct2flow on a recorded dump */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <libmnl/libmnl.h>
+#include <libnetfilter_conntrack/libnetfilter_conntrack.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include "../src/nftop.h"
+#include "../src/flow.h"
+
+#define ITERATIONS 100
+
+static int done_cb(const struct nlmsghdr *nlh, void *data) {
+    nlh = nlh;
+    (*(int *)data)++;
+    return MNL_CB_OK;
+}
+
+/* dump the conntrack table and write the raw netlink messages to path */
+int record(const char *path) {
+    char req[MNL_SOCKET_BUFFER_SIZE];
+    char buf[MNL_SOCKET_DUMP_SIZE];
+    struct mnl_socket *nl;
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfh;
+    int ret, entries = 0;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "w"))) {
+        perror("fopen");
+        return -1;
+    }
+
+    nl = mnl_socket_open(NETLINK_NETFILTER);
+    if (nl == NULL || mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+        perror("mnl_socket");
+        return -1;
+    }
+
+    nlh = mnl_nlmsg_put_header(req);
+    nlh->nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    nlh->nlmsg_seq = time(NULL);
+    nfh = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+    nfh->nfgen_family = AF_UNSPEC;
+    nfh->version = NFNETLINK_V0;
+    nfh->res_id = 0;
+
+    ret = mnl_socket_sendto(nl, nlh, nlh->nlmsg_len);
+    while (ret != -1) {
+        ret = mnl_socket_recvfrom(nl, buf, sizeof(buf));
+        if (ret == -1)
+            break;
+        fwrite(buf, 1, ret, fp);
+        ret = mnl_cb_run(buf, ret, nlh->nlmsg_seq, mnl_socket_get_portid(nl), done_cb, &entries);
+        if (ret <= MNL_CB_STOP)
+            break;
+    }
+
+    if (ret == -1)
+        printf("record: (%s)\n", strerror(errno));
+    else
+        printf("record: %d entries written to %s\n", entries, path);
+
+    mnl_socket_close(nl);
+    fclose(fp);
+
+    return ret;
+}
+
+static double elapsed(struct timespec *start, struct timespec *stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e9 + (stop->tv_nsec - start->tv_nsec);
+}
+
+int bench(const char *path, int iterations) {
+    struct timespec start, stop;
+    struct nf_conntrack *ct;
+    struct nlmsghdr *nlh;
+    struct Flow flow_ref, flow_fast;
+    double t_ref = 0, t_fast = 0;
+    int entries = 0, mismatches = 0, i, len;
+    long size;
+    char *buf;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r"))) {
+        perror("fopen");
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+
+    buf = malloc(size);
+    if (buf == NULL || fread(buf, 1, size, fp) != (size_t)size) {
+        perror("fread");
+        return -1;
+    }
+    fclose(fp);
+
+    ct = nfct_new();
+
+    // correctness: both parsers must produce the same flow record
+    for (nlh = (struct nlmsghdr *)buf, len = size; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+        if (nlh->nlmsg_type == NLMSG_DONE)
+            break;
+        memset(ct, 0, nfct_maxsize());
+        nfct_nlmsg_parse(nlh, ct);
+        ct2flow(ct, &flow_ref);
+        if (nlmsg2flow(nlh, &flow_fast) == -1 || memcmp(&flow_ref, &flow_fast, sizeof(struct Flow)) != 0)
+            mismatches++;
+        entries++;
+    }
+
+    for (i = 0; i < iterations; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (nlh = (struct nlmsghdr *)buf, len = size; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+            if (nlh->nlmsg_type == NLMSG_DONE)
+                break;
+            memset(ct, 0, nfct_maxsize());
+            nfct_nlmsg_parse(nlh, ct);
+            ct2flow(ct, &flow_ref);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_ref += elapsed(&start, &stop);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (nlh = (struct nlmsghdr *)buf, len = size; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+            if (nlh->nlmsg_type == NLMSG_DONE)
+                break;
+            nlmsg2flow(nlh, &flow_fast);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_fast += elapsed(&start, &stop);
+    }
+
+    printf("entries: %d (%ld bytes), iterations: %d, mismatches: %d\n", entries, size, iterations, mismatches);
+    if (entries > 0) {
+        printf("nfct_nlmsg_parse + ct2flow: %8.1f ns/entry\n", t_ref / iterations / entries);
+        printf("nlmsg2flow:                 %8.1f ns/entry\n", t_fast / iterations / entries);
+    }
+
+    nfct_destroy(ct);
+    free(buf);
+
+    return mismatches ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int c, ret = -1, iterations = ITERATIONS;
+    char *record_path = NULL, *read_path = NULL;
+
+    while ((c = getopt(argc, argv, "w:r:n:")) != -1) {
+        switch (c) {
+            case 'w':
+                record_path = optarg;
+                break;
+            case 'r':
+                read_path = optarg;
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s -w file | -r file [-n iterations]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (record_path)
+        ret = record(record_path);
+    else if (read_path)
+        ret = bench(read_path, iterations > 0 ? iterations : 1);
+    else
+        fprintf(stderr, "usage: %s -w file | -r file [-n iterations]\n", argv[0]);
+
+    ret == -1 ? exit(EXIT_FAILURE) : exit(EXIT_SUCCESS);
+}
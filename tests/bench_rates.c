@@ -0,0 +1,188 @@
+/* tests/bench_rates: the rates and threshold of a generation of flows, per record and over columns, scalar and vector */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libmnl/libmnl.h>
+#include "../src/nftop.h"
+#include "../src/rates.h"
+
+#define FLOWS           1000000
+#define ITERATIONS      10
+#define THRESH          1
+#define IDLE_PERCENT    60      // flows without a byte in the interval, as most of a large table is
+#define INELIGIBLE_PERCENT 5    // flows of a filtered family or namespace
+#define WRAPPED_PERCENT 1       // flows whose counters went backwards, so that their byte count wrapped
+#define HUGE_PERCENT    1       // flows of about 2^61 bytes, whose bit count wraps when multiplied by 8
+
+static double elapsed(struct timespec *start, struct timespec *stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e9 + (stop->tv_nsec - start->tv_nsec);
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* a connection as a record, the layout before the columns: the fields the loop reads among the rest of it */
+struct Record {
+    uint64_t sample_orig;
+    uint64_t sample_repl;
+    uint64_t sample_ns;
+    int64_t bps_rx;
+    int64_t bps_tx;
+    int64_t bps_sum;
+    time_t delta;
+    char rest[152];     // addresses, counters and the rest, 208 bytes in all
+};
+
+/* the loop ratesSelect() replaces: the arithmetic of set_rates() and the threshold, connection by connection */
+static size_t select_records(struct Record *flows, size_t n, int64_t thresh, uint32_t *selected) {
+    double per_sec, bps_rx, bps_tx;
+    size_t i, count = 0;
+
+    for (i = 0; i < n; i++) {
+        per_sec = (double)NSEC_PER_SEC / flows[i].sample_ns;
+        bps_rx = flows[i].sample_repl * 8 * per_sec;
+        bps_tx = flows[i].sample_orig * 8 * per_sec;
+        // rates past int64_t are not converted, and those of wrapped counters not displayed
+        if (bps_rx >= NFTOP_RATE_MAX || bps_tx >= NFTOP_RATE_MAX)
+            continue;
+        flows[i].bps_rx = bps_rx;
+        flows[i].bps_tx = bps_tx;
+        flows[i].bps_sum = flows[i].bps_rx + flows[i].bps_tx;
+        if (flows[i].delta > 0 && flows[i].bps_sum >= thresh)
+            selected[count++] = i;
+    }
+
+    return count;
+}
+
+int bench(size_t n, int iterations, int64_t thresh) {
+    struct RateColumns rates = { 0 };
+    struct timespec start, stop;
+    struct Record *flows;
+    uint64_t state = 88172645463325252ULL;
+    uint32_t *selected, *reference;
+    double t_records = 0, t_scalar = 0, t_kernel = 0;
+    size_t i, n_records = 0, n_scalar = 0, n_kernel = 0, n_rejected = 0;
+    uint64_t kind;
+    int j, ret = 0;
+
+    if (!(flows = calloc(n, sizeof(struct Record))) || !(selected = malloc(n * sizeof(uint32_t)))
+        || !(reference = malloc(n * sizeof(uint32_t)))) {
+        perror("malloc");
+        return -1;
+    }
+    ratesReserve(&rates, n);
+    rates.count = n;
+
+    // a second or so between observations, bytes from none to a few GB, and a few counters past any real rate
+    for (i = 0; i < n; i++) {
+        flows[i].delta = 1 + xorshift(&state) % 3600;
+        if (xorshift(&state) % 100 < INELIGIBLE_PERCENT)
+            flows[i].delta = 0;
+        flows[i].sample_ns = NSEC_PER_SEC + xorshift(&state) % (NSEC_PER_SEC / 10);
+        kind = xorshift(&state) % 100;
+        if (kind < WRAPPED_PERCENT) {
+            // a counter is below the one of the previous observation, by anything up to 2^64
+            flows[i].sample_orig = xorshift(&state) >> (xorshift(&state) % 32 + 32);
+            flows[i].sample_repl = 0 - (xorshift(&state) >> xorshift(&state) % 64) - 1;
+            if (xorshift(&state) % 2) {
+                kind = flows[i].sample_orig;
+                flows[i].sample_orig = flows[i].sample_repl;
+                flows[i].sample_repl = kind;
+            }
+        } else if (kind < WRAPPED_PERCENT + HUGE_PERCENT) {
+            // on either side of 2^61, where bytes * 8 wraps to small rates
+            flows[i].sample_orig = (1ULL << 61) - 1024 + xorshift(&state) % 2048;
+            flows[i].sample_repl = xorshift(&state) % 2 ? (1ULL << 61) + xorshift(&state) % 1024 : 0;
+        } else if (kind >= IDLE_PERCENT) {
+            flows[i].sample_orig = xorshift(&state) >> (xorshift(&state) % 32 + 32);
+            flows[i].sample_repl = xorshift(&state) >> (xorshift(&state) % 32 + 32);
+        }
+
+        rates.bytes_orig[i] = flows[i].sample_orig;
+        rates.bytes_repl[i] = flows[i].sample_repl;
+        rates.elapsed[i] = flows[i].sample_ns;
+        rates.eligible[i] = flows[i].delta > 0;
+    }
+
+    for (j = 0; j < iterations; j++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        n_records = select_records(flows, n, thresh, selected);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_records += elapsed(&start, &stop);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        n_scalar = ratesSelectScalar(&rates, thresh);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_scalar += elapsed(&start, &stop);
+        memcpy(reference, rates.selected, n_scalar * sizeof(uint32_t));
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        n_kernel = ratesSelect(&rates, thresh);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t_kernel += elapsed(&start, &stop);
+    }
+
+    for (i = 0; i < n; i++)
+        n_rejected += rates.eligible[i] && (rates.bps_orig[i] >= NFTOP_RATE_MAX || rates.bps_repl[i] >= NFTOP_RATE_MAX);
+
+    printf("flows: %zu, iterations: %d, threshold: %ld bps, selected: %zu, rejected (2^52 bps or more): %zu\n",
+        n, iterations, (long)thresh, n_kernel, n_rejected);
+    printf("per record (208 bytes):         %8.2f ms (%5.2f ns/flow)\n", t_records / iterations / 1e6, t_records / iterations / n);
+    printf("columns, scalar:                 %8.2f ms (%5.2f ns/flow)\n", t_scalar / iterations / 1e6, t_scalar / iterations / n);
+    printf("columns, %-6s kernel:          %8.2f ms (%5.2f ns/flow)\n", ratesKernel(), t_kernel / iterations / 1e6, t_kernel / iterations / n);
+
+    // the kernel selects the flows the scalar loop and the old loop select, with the same rates
+    if (n_kernel != n_scalar || n_kernel != n_records || memcmp(rates.selected, reference, n_kernel * sizeof(uint32_t)) != 0
+        || memcmp(selected, reference, n_kernel * sizeof(uint32_t)) != 0) {
+        printf("mismatch: per record selected %zu, scalar %zu, kernel %zu\n", n_records, n_scalar, n_kernel);
+        ret = -1;
+    }
+    for (i = 0; i < n_kernel && ret == 0; i++) {
+        if ((int64_t)rates.bps_orig[rates.selected[i]] != flows[rates.selected[i]].bps_tx
+            || (int64_t)rates.bps_repl[rates.selected[i]] != flows[rates.selected[i]].bps_rx) {
+            printf("mismatch: rates of flow %u\n", rates.selected[i]);
+            ret = -1;
+        }
+    }
+
+    ratesFree(&rates);
+    free(reference);
+    free(selected);
+    free(flows);
+
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int c, ret, iterations = ITERATIONS;
+    int64_t thresh = THRESH;
+    size_t flows = FLOWS;
+
+    while ((c = getopt(argc, argv, "f:n:t:")) != -1) {
+        switch (c) {
+            case 'f':
+                flows = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 't':
+                thresh = atoll(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-f flows] [-n iterations] [-t threshold]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    ret = bench(flows > 0 ? flows : 1, iterations > 0 ? iterations : 1, thresh);
+
+    ret == -1 ? exit(EXIT_FAILURE) : exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,281 @@
+/* tests/proc_parse: check procline2flow and procRead against tests/fixtures/nf_conntrack, and time the parser on any file in that format */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/netfilter/nf_conntrack_common.h>
+#include "../src/nftop.h"
+#include "../src/proc.h"
+
+#define ITERATIONS 100
+#define MAX_ENTRIES 64      // entries of the fixture procRead() is checked with
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("line %d: check failed: %s\n", line, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static char *read_file(const char *path, long *size) {
+    char *buf;
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r"))) {
+        perror("fopen");
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    rewind(fp);
+
+    buf = malloc(*size);
+    if (buf == NULL || fread(buf, 1, *size, fp) != (size_t)*size) {
+        perror("fread");
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    return buf;
+}
+
+static int addr_is(uint8_t family, const struct in6_addr *addr, const char *expected) {
+    struct in6_addr want;
+
+    memset(&want, 0, sizeof(want));
+    inet_pton(family, expected, &want);
+
+    return memcmp(addr, &want, sizeof(want)) == 0;
+}
+
+/* the expected records of the fixture, line by line */
+int check(const char *path) {
+    struct Flow flow, again;
+    char *buf, *p, *nl;
+    int line = 0, failures = 0, ret;
+    long size;
+
+    if (!(buf = read_file(path, &size)))
+        return -1;
+
+    for (p = buf; (nl = memchr(p, '\n', buf + size - p)) != NULL; p = nl + 1) {
+        line++;
+        ret = procline2flow(p, nl - p, &flow);
+
+        switch (line) {
+            case 1: // NATed (both directions) TCP with a mark
+                CHECK(ret == 0);
+                CHECK(flow.proto_l3 == AF_INET && flow.proto_l4 == IPPROTO_TCP);
+                CHECK(flow.status_l4 == TCP_CONNTRACK_ESTABLISHED);
+                CHECK(addr_is(AF_INET, &flow.orig_src, "10.0.0.2") && addr_is(AF_INET, &flow.orig_dst, "192.0.2.1"));
+                CHECK(addr_is(AF_INET, &flow.repl_src, "192.0.2.1") && addr_is(AF_INET, &flow.repl_dst, "198.51.100.2"));
+                CHECK(ntohs(flow.orig_sport) == 51234 && ntohs(flow.orig_dport) == 443);
+                CHECK(ntohs(flow.repl_sport) == 443 && ntohs(flow.repl_dport) == 40000);
+                CHECK(flow.bytes_orig == 1200 && flow.bytes_repl == 5000);
+                CHECK(flow.mark == 256 && flow.zone == 0);
+                CHECK(flow.status & IPS_ASSURED && flow.status & IPS_SEEN_REPLY);
+                CHECK(flow.status & IPS_SRC_NAT && !(flow.status & IPS_DST_NAT));
+                CHECK(flow.id != 0);
+                break;
+            case 2: // unreplied UDP
+                CHECK(ret == 0);
+                CHECK(flow.proto_l4 == IPPROTO_UDP && flow.status_l4 == 0);
+                CHECK(!(flow.status & IPS_SEEN_REPLY) && !(flow.status & (IPS_SRC_NAT | IPS_DST_NAT)));
+                CHECK(flow.bytes_orig == 74 && flow.bytes_repl == 0);
+                break;
+            case 3: // ICMP as ct2flow() stores it
+                CHECK(ret == 0);
+                CHECK(flow.proto_l4 == IPPROTO_ICMP);
+                CHECK(ntohs(flow.orig_sport) == 4242 && flow.orig_dport == (8 << 8));
+                CHECK(flow.repl_sport == 0 && flow.repl_dport == 0);
+                CHECK(!(flow.status & (IPS_SRC_NAT | IPS_DST_NAT)));
+                break;
+            case 4: // IPv6 with a security context and a zone
+                CHECK(ret == 0);
+                CHECK(flow.proto_l3 == AF_INET6 && flow.status_l4 == TCP_CONNTRACK_TIME_WAIT);
+                CHECK(addr_is(AF_INET6, &flow.orig_src, "2001:db8::2") && addr_is(AF_INET6, &flow.repl_src, "2001:db8:1::80"));
+                CHECK(flow.bytes_orig == 480 && flow.bytes_repl == 9000);
+                CHECK(flow.zone == 7);
+                break;
+            case 5: // 64 bit counters; the ID is a stable hash of the tuple
+                CHECK(ret == 0);
+                CHECK(flow.bytes_orig == 123456789012ULL);
+                CHECK(procline2flow(p, nl - p, &again) == 0 && again.id == flow.id);
+                break;
+            case 6: // not an entry
+            case 7: // truncated, no reply tuple
+                CHECK(ret == -1);
+                break;
+        }
+    }
+
+    printf("%d lines, %d failed checks\n", line, failures);
+    free(buf);
+
+    return failures ? -1 : 0;
+}
+
+/* the IDs and counters of the entries procRead() passes on, in order */
+struct Entries {
+    uint32_t id[MAX_ENTRIES];
+    uint64_t bytes[MAX_ENTRIES];
+    int count;
+};
+
+static void entry_cb(struct Flow *flow, void *data) {
+    struct Entries *entries = (struct Entries *) data;
+
+    if (entries->count < MAX_ENTRIES) {
+        entries->id[entries->count] = flow->id;
+        entries->bytes[entries->count] = flow->bytes_orig + flow->bytes_repl;
+    }
+    entries->count++;
+}
+
+/* the entries of size bytes of content, written to a temporary file and read through a buffer of bufsize bytes */
+static int read_entries(const char *content, long size, size_t bufsize, struct Entries *entries, uint64_t *syscalls) {
+    struct ProcReader reader = { 0 };
+    FILE *fp;
+    int ret;
+
+    if (!(fp = tmpfile()) || fwrite(content, 1, size, fp) != (size_t)size || fflush(fp) != 0) {
+        perror("tmpfile");
+        return -1;
+    }
+    rewind(fp);
+
+    if (!(reader.buf = malloc(bufsize))) {
+        perror("malloc");
+        fclose(fp);
+        return -1;
+    }
+    reader.size = bufsize;
+    reader.flow_cb = entry_cb;
+    reader.data = entries;
+    memset(entries, 0, sizeof(*entries));
+
+    ret = procRead(&reader, fileno(fp));
+    *syscalls = reader.syscalls;
+
+    free(reader.buf);
+    fclose(fp);
+
+    return ret;
+}
+
+/*
+ * the entries procRead() finds with buffers from the longest line up, where lines are split between
+ * reads, and without the last newline, are those it finds with a buffer holding the whole fixture
+ */
+int check_reader(const char *path) {
+    struct Entries whole, small;
+    uint64_t syscalls;
+    char *buf, *p, *nl;
+    size_t longest = 0, bufsize;
+    int line = 0, failures = 0;
+    long size;
+
+    if (!(buf = read_file(path, &size)))
+        return -1;
+
+    for (p = buf; (nl = memchr(p, '\n', buf + size - p)) != NULL; p = nl + 1) {
+        if ((size_t)(nl - p) > longest)
+            longest = nl - p;
+    }
+
+    CHECK(read_entries(buf, size, NFTOP_PROC_BUFSIZ, &whole, &syscalls) == 0);
+    CHECK(whole.count == 5 && whole.count <= MAX_ENTRIES);
+
+    // failed checks are reported with the buffer size in place of the line
+    for (bufsize = longest + 1; bufsize < (size_t)size; bufsize++) {
+        line = bufsize;
+        CHECK(read_entries(buf, size, bufsize, &small, &syscalls) == 0);
+        CHECK(small.count == whole.count && syscalls > 2);
+        CHECK(memcmp(small.id, whole.id, sizeof(small.id)) == 0 && memcmp(small.bytes, whole.bytes, sizeof(small.bytes)) == 0);
+
+        // the last line without its newline
+        CHECK(read_entries(buf, size - 1, bufsize, &small, &syscalls) == 0);
+        CHECK(small.count == whole.count);
+        CHECK(memcmp(small.id, whole.id, sizeof(small.id)) == 0 && memcmp(small.bytes, whole.bytes, sizeof(small.bytes)) == 0);
+    }
+
+    // a buffer too small for a line drops that line, and only that one
+    line = longest;
+    CHECK(read_entries(buf, size, longest, &small, &syscalls) == 0);
+    CHECK(small.count == whole.count - 1);
+
+    printf("procRead: buffers of %zu to %ld bytes, %d failed checks\n", longest + 1, size - 1, failures);
+    free(buf);
+
+    return failures ? -1 : 0;
+}
+
+static double elapsed(struct timespec *start, struct timespec *stop) {
+    return (stop->tv_sec - start->tv_sec) * 1e9 + (stop->tv_nsec - start->tv_nsec);
+}
+
+int bench(const char *path, int iterations) {
+    struct timespec start, stop;
+    struct Flow flow;
+    char *buf, *p, *nl;
+    double t = 0;
+    int entries = 0, i;
+    long size;
+
+    if (!(buf = read_file(path, &size)))
+        return -1;
+
+    for (i = 0; i < iterations; i++) {
+        entries = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (p = buf; (nl = memchr(p, '\n', buf + size - p)) != NULL; p = nl + 1) {
+            if (procline2flow(p, nl - p, &flow) == 0)
+                entries++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        t += elapsed(&start, &stop);
+    }
+
+    printf("entries: %d (%ld bytes), iterations: %d\n", entries, size, iterations);
+    if (entries > 0)
+        printf("procline2flow: %8.1f ns/entry, %6.2f GB/s\n", t / iterations / entries, size * iterations / t);
+
+    free(buf);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int c, ret = -1, iterations = ITERATIONS;
+    char *check_path = NULL, *read_path = NULL;
+
+    while ((c = getopt(argc, argv, "c:r:n:")) != -1) {
+        switch (c) {
+            case 'c':
+                check_path = optarg;
+                break;
+            case 'r':
+                read_path = optarg;
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s -c fixture | -r file [-n iterations]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (check_path)
+        ret = check(check_path) == -1 || check_reader(check_path) == -1 ? -1 : 0;
+    else if (read_path)
+        ret = bench(read_path, iterations > 0 ? iterations : 1);
+    else
+        fprintf(stderr, "usage: %s -c fixture | -r file [-n iterations]\n", argv[0]);
+
+    ret == -1 ? exit(EXIT_FAILURE) : exit(EXIT_SUCCESS);
+}